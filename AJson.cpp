@@ -1,532 +1,3774 @@
 #include "AJson.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
 #include <cmath>
+#include <cstddef>
+#include <condition_variable>
+#include <cstdio>
 #include <cstdlib>
-//#include <cstdio>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32) && !defined(AJ_NO_MMAP)
+#define AJ_NO_MMAP
+#endif
+#ifndef AJ_NO_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#if !defined(AJ_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64))
+#define AJ_SIMD_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AJ_TARGET_AVX2
+#else
+#include <immintrin.h>
+#define AJ_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
 
 #define ISDIGIT(ch) ((ch) >= '0' && (ch) <= '9')
 #define ISDIGIT1TO9(ch) ((ch) > '0' && (ch) <= '9')
-#define PUTC(ch)	\
+#define PUTC(c, ch)	\
     do {			\
-        *static_cast<char*>(contextPush(sizeof(char))) = (ch); \
+        *static_cast<char*>((c).push(sizeof(char))) = (ch); \
     } while (0)
-#define PUTS(s,len)	\
+#define PUTS(c, s, len)	\
 	do{				\
-		memcpy(contextPush(sizeof(char) * len), s, len); \
+		memcpy((c).push(sizeof(char) * (len)), s, len); \
 	} while (0)
 
 namespace AJson {
-	Context Value::s_c;
-	char Value::s_table[] = { "0123456789ABCDEF" };
+	const char Value::s_table[] = { "0123456789ABCDEF" };
 
-	ParseResult Value::parse(const char *s)
+	/* the byte at p, or '\0' at the end of the input (never a valid token start) */
+	static inline char peek(const char *p, const char *end)
 	{
-		assert(s != nullptr);
-		s_c.size = s_c.top = 0;
-		s_c.json = s;
-		parseWhitespace();
-		auto res = parseValue();
-		if (res == PARSE_OK) {
-			parseWhitespace();
-			if (*s_c.json != '\0') {
-				res = PARSE_ROOT_NOT_SINGULAR;
-				m_type = VALUE_TYPE_NULL;
-			}
+		return p != end ? *p : '\0';
+	}
+
+	/*
+	 * The open containers of a walk over nested values, so parsing,
+	 * stringifying, copying and freeing take no C stack per level. The
+	 * first levels live in the object itself, deeper ones on the heap.
+	 */
+	template <typename T>
+	class LevelStack {
+	public:
+		LevelStack() = default;
+		LevelStack(const LevelStack&) = delete;
+		LevelStack& operator=(const LevelStack&) = delete;
+		~LevelStack()
+		{
+			if (m_p != m_local)
+				free(m_p);
+		}
+
+		bool empty() const { return m_size == 0; }
+		size_t size() const { return m_size; }
+		T& top() { return m_p[m_size - 1]; }
+		void push(const T &t)
+		{
+			if (m_size == m_capacity)
+				grow();
+			m_p[m_size++] = t;
+		}
+		T pop() { return m_p[--m_size]; }
+	private:
+		T m_local[16];
+		T *m_p = m_local;
+		size_t m_size = 0, m_capacity = 16;
+
+		void grow()
+		{
+			T *p = static_cast<T *>(m_p == m_local ? malloc(sizeof(T) * m_capacity * 2) : realloc(m_p, sizeof(T) * m_capacity * 2));
+			if (m_p == m_local)
+				memcpy(p, m_local, sizeof(T) * m_size);
+			m_p = p;
+			m_capacity *= 2;
+		}
+	};
+
+	/* decimal digits of u at p, two at a time; returns the end */
+	static char* writeUint64(char *p, uint64_t u)
+	{
+		static const char digits[] =
+			"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+			"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+			"8081828384858687888990919293949596979899";
+		char buf[20];
+		char *q = buf + sizeof(buf);
+		while (u >= 100) {
+			unsigned i = static_cast<unsigned>(u % 100) * 2;
+			u /= 100;
+			*--q = digits[i + 1];
+			*--q = digits[i];
+		}
+		if (u >= 10) {
+			*--q = digits[u * 2 + 1];
+			*--q = digits[u * 2];
 		} else {
-			m_type = VALUE_TYPE_NULL;
+			*--q = static_cast<char>('0' + u);
 		}
-		assert(s_c.top == 0);
-		free(s_c.stack);
-		s_c.stack = nullptr;
-		return res;
+		size_t n = buf + sizeof(buf) - q;
+		memcpy(p, q, n);
+		return p + n;
 	}
 
-	void Value::setString(const char *s, size_t len)
+	/*
+	 * Grisu2 (Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with Integers"):
+	 * the shortest digit string that reads back as the same double, in almost every case,
+	 * and always one that does.
+	 */
+	struct DiyFp {
+		uint64_t f;
+		int e;
+	};
+
+	static const uint64_t kDpHiddenBit = 0x0010000000000000ull;
+
+	static inline DiyFp diyFp(double d)
 	{
-		assert(s != nullptr || len == 0);
-		freeMem();
-		m_s.s = (char *)malloc(sizeof(char) * (len + 1));
-		memcpy(m_s.s, s, len);
-		m_s.s[len] = '\0';
-		m_s.len = len;
-		m_type = VALUE_TYPE_STRING;
+		uint64_t u;
+		memcpy(&u, &d, sizeof(u));
+		int biased = static_cast<int>((u >> 52) & 0x7ff);
+		uint64_t m = u & (kDpHiddenBit - 1);
+		if (biased != 0)
+			return DiyFp{ m + kDpHiddenBit, biased - 1075 };
+		return DiyFp{ m, -1074 };
 	}
 
-	const char* Value::getObjectKey(size_t index) const
+	/* upper 64 bits of the 128-bit product, rounded */
+	static inline DiyFp multiply(const DiyFp &x, const DiyFp &y)
 	{
-		assert(m_type == VALUE_TYPE_OBJECT && index < m_o.size);
-		return (m_o.m + index)->k;
+		const uint64_t m32 = 0xffffffffu;
+		uint64_t a = x.f >> 32, b = x.f & m32, c = y.f >> 32, d = y.f & m32;
+		uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+		uint64_t tmp = (bd >> 32) + (ad & m32) + (bc & m32) + (1u << 31);
+		return DiyFp{ ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), x.e + y.e + 64 };
 	}
 
-	size_t Value::getObjectKeyLength(size_t index) const
+	static inline DiyFp normalize(DiyFp x)
 	{
-		assert(m_type == VALUE_TYPE_OBJECT && index < m_o.size);
-		return (m_o.m + index)->klen;
+		while (!(x.f & 0x8000000000000000ull)) {
+			x.f <<= 1;
+			x.e--;
+		}
+		return x;
 	}
 
-	Value* Value::getObjectValue(size_t index)
+	/* m- and m+, the halfway points to the neighbouring doubles, sharing m+'s exponent */
+	static inline void boundaries(const DiyFp &v, DiyFp &minus, DiyFp &plus)
 	{
-		assert(m_type == VALUE_TYPE_OBJECT && index < m_o.size);
-		return &((m_o.m + index)->v);
+		plus = normalize(DiyFp{ (v.f << 1) + 1, v.e - 1 });
+		minus = v.f == kDpHiddenBit ? DiyFp{ (v.f << 2) - 1, v.e - 2 } : DiyFp{ (v.f << 1) - 1, v.e - 1 };
+		minus.f <<= minus.e - plus.e;
+		minus.e = plus.e;
 	}
 
-	Value* Value::getObjectValue(size_t index) const
+	/* c = 10^-k normalized, with k chosen so that c * 2^e lands in [2^-60, 2^-32) */
+	static inline DiyFp cachedPower(int e, int &k)
 	{
-		assert(m_type == VALUE_TYPE_OBJECT && index < m_o.size);
-		return &((m_o.m + index)->v);
+		/* 10^(-348 + 8i) */
+		static const DiyFp powers[] = {
+		{ 0xfa8fd5a0081c0288, -1220 }, { 0xbaaee17fa23ebf76, -1193 }, { 0x8b16fb203055ac76, -1166 },
+		{ 0xcf42894a5dce35ea, -1140 }, { 0x9a6bb0aa55653b2d, -1113 }, { 0xe61acf033d1a45df, -1087 },
+		{ 0xab70fe17c79ac6ca, -1060 }, { 0xff77b1fcbebcdc4f, -1034 }, { 0xbe5691ef416bd60c, -1007 },
+		{ 0x8dd01fad907ffc3c, -980 }, { 0xd3515c2831559a83, -954 }, { 0x9d71ac8fada6c9b5, -927 },
+		{ 0xea9c227723ee8bcb, -901 }, { 0xaecc49914078536d, -874 }, { 0x823c12795db6ce57, -847 },
+		{ 0xc21094364dfb5637, -821 }, { 0x9096ea6f3848984f, -794 }, { 0xd77485cb25823ac7, -768 },
+		{ 0xa086cfcd97bf97f4, -741 }, { 0xef340a98172aace5, -715 }, { 0xb23867fb2a35b28e, -688 },
+		{ 0x84c8d4dfd2c63f3b, -661 }, { 0xc5dd44271ad3cdba, -635 }, { 0x936b9fcebb25c996, -608 },
+		{ 0xdbac6c247d62a584, -582 }, { 0xa3ab66580d5fdaf6, -555 }, { 0xf3e2f893dec3f126, -529 },
+		{ 0xb5b5ada8aaff80b8, -502 }, { 0x87625f056c7c4a8b, -475 }, { 0xc9bcff6034c13053, -449 },
+		{ 0x964e858c91ba2655, -422 }, { 0xdff9772470297ebd, -396 }, { 0xa6dfbd9fb8e5b88f, -369 },
+		{ 0xf8a95fcf88747d94, -343 }, { 0xb94470938fa89bcf, -316 }, { 0x8a08f0f8bf0f156b, -289 },
+		{ 0xcdb02555653131b6, -263 }, { 0x993fe2c6d07b7fac, -236 }, { 0xe45c10c42a2b3b06, -210 },
+		{ 0xaa242499697392d3, -183 }, { 0xfd87b5f28300ca0e, -157 }, { 0xbce5086492111aeb, -130 },
+		{ 0x8cbccc096f5088cc, -103 }, { 0xd1b71758e219652c, -77 }, { 0x9c40000000000000, -50 },
+		{ 0xe8d4a51000000000, -24 }, { 0xad78ebc5ac620000, 3 }, { 0x813f3978f8940984, 30 },
+		{ 0xc097ce7bc90715b3, 56 }, { 0x8f7e32ce7bea5c70, 83 }, { 0xd5d238a4abe98068, 109 },
+		{ 0x9f4f2726179a2245, 136 }, { 0xed63a231d4c4fb27, 162 }, { 0xb0de65388cc8ada8, 189 },
+		{ 0x83c7088e1aab65db, 216 }, { 0xc45d1df942711d9a, 242 }, { 0x924d692ca61be758, 269 },
+		{ 0xda01ee641a708dea, 295 }, { 0xa26da3999aef774a, 322 }, { 0xf209787bb47d6b85, 348 },
+		{ 0xb454e4a179dd1877, 375 }, { 0x865b86925b9bc5c2, 402 }, { 0xc83553c5c8965d3d, 428 },
+		{ 0x952ab45cfa97a0b3, 455 }, { 0xde469fbd99a05fe3, 481 }, { 0xa59bc234db398c25, 508 },
+		{ 0xf6c69a72a3989f5c, 534 }, { 0xb7dcbf5354e9bece, 561 }, { 0x88fcf317f22241e2, 588 },
+		{ 0xcc20ce9bd35c78a5, 614 }, { 0x98165af37b2153df, 641 }, { 0xe2a0b5dc971f303a, 667 },
+		{ 0xa8d9d1535ce3b396, 694 }, { 0xfb9b7cd9a4a7443c, 720 }, { 0xbb764c4ca7a44410, 747 },
+		{ 0x8bab8eefb6409c1a, 774 }, { 0xd01fef10a657842c, 800 }, { 0x9b10a4e5e9913129, 827 },
+		{ 0xe7109bfba19c0c9d, 853 }, { 0xac2820d9623bf429, 880 }, { 0x80444b5e7aa7cf85, 907 },
+		{ 0xbf21e44003acdd2d, 933 }, { 0x8e679c2f5e44ff8f, 960 }, { 0xd433179d9c8cb841, 986 },
+		{ 0x9e19db92b4e31ba9, 1013 }, { 0xeb96bf6ebadf77d9, 1039 }, { 0xaf87023b9bf0ee6b, 1066 }
+		};
+		double dk = (-61 - e) * 0.30102999566398114 + 347;
+		int ik = static_cast<int>(dk);
+		if (dk - ik > 0.0)
+			ik++;
+		unsigned index = static_cast<unsigned>((ik >> 3) + 1);
+		k = -(-348 + static_cast<int>(index) * 8);
+		return powers[index];
 	}
 
-	std::string Value::stringify() const
+	static const uint64_t s_pow10[] = {
+		1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull, 100000000ull, 1000000000ull,
+		10000000000ull, 100000000000ull, 1000000000000ull, 10000000000000ull, 100000000000000ull,
+		1000000000000000ull, 10000000000000000ull, 100000000000000000ull, 1000000000000000000ull,
+		10000000000000000000ull
+	};
+
+	/* nudge the last digit towards w while staying inside the rounding interval */
+	static inline void grisuRound(char *buf, int len, uint64_t delta, uint64_t rest, uint64_t tenKappa, uint64_t wpw)
 	{
-		s_c.stack = static_cast<char *>(malloc(s_c.size = AJ_PARSE_STRINGIFY_INIT_SIZE));
-		s_c.top = 0;
+		while (rest < wpw && delta - rest >= tenKappa &&
+			(rest + tenKappa < wpw || wpw - rest > rest + tenKappa - wpw)) {
+			buf[len - 1]--;
+			rest += tenKappa;
+		}
+	}
 
-		if (stringifyValue() != STRINGIFY_OK) {
-			free(s_c.stack);
-			s_c.stack = nullptr;
-			return std::string();
+	static inline int countDigits(uint32_t n)
+	{
+		int d = 1;
+		while (d < 10 && n >= s_pow10[d])
+			++d;
+		return d;
+	}
+
+	static void digitGen(const DiyFp &w, const DiyFp &mp, uint64_t delta, char *buf, int &len, int &k)
+	{
+		const DiyFp one{ 1ull << -mp.e, mp.e };
+		const uint64_t wpw = mp.f - w.f;
+		uint32_t p1 = static_cast<uint32_t>(mp.f >> -one.e);
+		uint64_t p2 = mp.f & (one.f - 1);
+		int kappa = countDigits(p1);
+		len = 0;
+		while (kappa > 0) {
+			uint32_t d = p1 / static_cast<uint32_t>(s_pow10[kappa - 1]);
+			p1 %= static_cast<uint32_t>(s_pow10[kappa - 1]);
+			if (d || len)
+				buf[len++] = static_cast<char>('0' + d);
+			kappa--;
+			uint64_t rest = (static_cast<uint64_t>(p1) << -one.e) + p2;
+			if (rest <= delta) {
+				k += kappa;
+				grisuRound(buf, len, delta, rest, s_pow10[kappa] << -one.e, wpw);
+				return;
+			}
 		}
+		for (;;) {
+			p2 *= 10;
+			delta *= 10;
+			char d = static_cast<char>(p2 >> -one.e);
+			if (d || len)
+				buf[len++] = static_cast<char>('0' + d);
+			p2 &= one.f - 1;
+			kappa--;
+			if (p2 < delta) {
+				k += kappa;
+				grisuRound(buf, len, delta, p2, one.f, -kappa < 20 ? wpw * s_pow10[-kappa] : 0);
+				return;
+			}
+		}
+	}
 
-		PUTC('\0');
-		std::string res(s_c.stack);
-		free(s_c.stack);
-		s_c.stack = nullptr;
-		return res;
+	/* digits of a positive finite d into buf; d == buf[0..len) * 10^k */
+	static void grisu2(double d, char *buf, int &len, int &k)
+	{
+		DiyFp v = diyFp(d), minus, plus;
+		boundaries(v, minus, plus);
+		DiyFp c = cachedPower(plus.e, k);
+		DiyFp w = multiply(normalize(v), c);
+		DiyFp wp = multiply(plus, c), wm = multiply(minus, c);
+		wm.f++;
+		wp.f--;
+		digitGen(w, wp, wp.f - wm.f, buf, len, k);
 	}
 
-	ParseResult Value::parseValue()
+	static inline char* writeExponent(char *p, int e)
 	{
-		switch (*s_c.json) {
-		case 'n': return parseLiteral("null", VALUE_TYPE_NULL);
-		case 't': return parseLiteral("true", VALUE_TYPE_TRUE);
-		case 'f': return parseLiteral("false", VALUE_TYPE_FALSE);
-		case '\"': return parseString();
-		case '\0': return PARSE_EXPECT_VALUE;
-		case '[': return parseArray();
-		case '{': return parseObject();
-		default:
-			if (*s_c.json == '-' || ISDIGIT(*s_c.json))
-				return parseNumber();
-			return PARSE_INVALID_VALUE;
+		if (e < 0) {
+			*p++ = '-';
+			e = -e;
 		}
+		return writeUint64(p, static_cast<uint64_t>(e));
 	}
 
-	/* ws = *(%x20 / %x09 / %x0A / %x0D) */
-	void Value::parseWhitespace()
+	/*
+	 * shortest round-trip text of a finite double at p (room for 25 chars); returns the end.
+	 * Integral values keep a ".0" so they read back as doubles, not integers.
+	 */
+	static char* writeDouble(char *p, double d)
 	{
-		const char* p = s_c.json;
-		while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
-			++p;
-		s_c.json = p;
+		if (std::signbit(d)) {
+			*p++ = '-';
+			d = -d;
+		}
+		if (d == 0) {
+			memcpy(p, "0.0", 3);
+			return p + 3;
+		}
+		int len, k;
+		grisu2(d, p, len, k);
+		const int kk = len + k;	/* 10^(kk-1) <= d < 10^kk */
+		if (k >= 0 && kk <= 21) {
+			/* 1234e7 -> 12340000000.0 */
+			memset(p + len, '0', kk - len);
+			memcpy(p + kk, ".0", 2);
+			return p + kk + 2;
+		}
+		if (kk > 0 && kk <= 21) {
+			/* 1234e-2 -> 12.34 */
+			memmove(p + kk + 1, p + kk, len - kk);
+			p[kk] = '.';
+			return p + len + 1;
+		}
+		if (kk > -6 && kk <= 0) {
+			/* 1234e-6 -> 0.001234 */
+			int offset = 2 - kk;
+			memmove(p + offset, p, len);
+			p[0] = '0';
+			p[1] = '.';
+			memset(p + 2, '0', offset - 2);
+			return p + len + offset;
+		}
+		if (len == 1) {
+			/* 1e30 */
+			p[1] = 'e';
+			return writeExponent(p + 2, kk - 1);
+		}
+		/* 1234e30 -> 1.234e33 */
+		memmove(p + 2, p + 1, len - 1);
+		p[1] = '.';
+		p[len + 1] = 'e';
+		return writeExponent(p + len + 2, kk - 1);
 	}
 
-	ParseResult Value::parseLiteral(const char* literal, ValueType type)
+	static inline bool isWhitespace(char ch)
 	{
-		size_t i = 1;
-		for (; literal[i]; ++i)
-			if (s_c.json[i] != literal[i])
-				return PARSE_INVALID_VALUE;
-		s_c.json += i;
-		m_type = type;
+		return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+	}
 
-		return PARSE_OK;
+	static inline bool isStringSpecial(unsigned char ch)
+	{
+		return ch == '"' || ch == '\\' || ch < 0x20;
 	}
 
-	ParseResult Value::parseNumber()
+	/* high bit set in every byte of w that is '"', '\\' or a control character */
+	static inline uint64_t stringSpecials(uint64_t w)
 	{
-		const char* p = s_c.json;
+		const uint64_t ones = 0x0101010101010101ull, highs = 0x8080808080808080ull;
+		uint64_t q = w ^ (ones * '"'), b = w ^ (ones * '\\');
+		return ((q - ones) & ~q & highs) | ((b - ones) & ~b & highs) | ((w - ones * 0x20) & ~w & highs);
+	}
 
-		if (*p == '-')
-			++p;
-		if (*p == '0')
-			++p;
-		else {
-			if (!ISDIGIT1TO9(*p))
-				return PARSE_INVALID_VALUE;
-			for (++p; ISDIGIT(*p); ++p)
-				;
-		}
-		if (*p == '.') {
+	/*
+	 * Scanners: return the first byte in [p, end) that is not whitespace, or
+	 * that is '"', '\\' or a control character inside a string; end if none.
+	 * Blocks are tested a word or vector at a time. With padded input the
+	 * last block may read past end, otherwise the tail is done bytewise.
+	 */
+	static const char* skipWhitespaceScalar(const char *p, const char *end, bool)
+	{
+		while (p != end && isWhitespace(*p))
 			++p;
-			if (!ISDIGIT(*p))
-				return PARSE_INVALID_VALUE;
-			for (++p; ISDIGIT(*p); ++p)
-				;
+		return p;
+	}
+
+	static const char* scanStringSwar(const char *p, const char *end, bool padded)
+	{
+		uint64_t w;
+		if (padded) {
+			for (; p < end; p += 8) {
+				memcpy(&w, p, 8);
+				if (stringSpecials(w))
+					break;
+			}
+			if (p >= end)
+				return end;
+		} else {
+			for (; end - p >= 8; p += 8) {
+				memcpy(&w, p, 8);
+				if (stringSpecials(w))
+					break;
+			}
 		}
-		if (*p == 'e' || *p == 'E') {
+		while (p != end && !isStringSpecial(*p))
 			++p;
-			if (*p == '-' || *p == '+')
-				++p;
-			if (!ISDIGIT(*p))
-				return PARSE_INVALID_VALUE;
-			for (++p; ISDIGIT(*p); ++p)
-				;
-		}
+		return p;
+	}
 
-		errno = 0;
-		m_n = strtod(s_c.json, nullptr);
-		if (errno == ERANGE && (m_n == HUGE_VAL || m_n == -HUGE_VAL)) {
-			return PARSE_NUMBER_TOO_BIG;
-		}
-		s_c.json = p;
-		m_type = VALUE_TYPE_NUMBER;
-		return PARSE_OK;
+#ifdef AJ_SIMD_X86
+	static inline unsigned ctz(unsigned mask)
+	{
+#ifdef _MSC_VER
+		unsigned long i;
+		_BitScanForward(&i, mask);
+		return i;
+#else
+		return __builtin_ctz(mask);
+#endif
 	}
 
-#define STRING_ERROR(ret)	\
-    do {					\
-        s_c.top = head;		\
-        return ret;			\
-    } while (0)
+	static inline unsigned whitespaceMask16(__m128i x)
+	{
+		__m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\t'))),
+			_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\r'))));
+		return ~_mm_movemask_epi8(ws) & 0xffff;
+	}
 
-	ParseResult Value::parseStringRaw(char *&str, size_t &len)
+	static inline unsigned stringMask16(__m128i x)
 	{
-		size_t head = s_c.top;
-		const char* p = ++s_c.json;
-		for (;;) {
-			char ch = *p++;
-			switch (ch) {
-			case '\"':
-				len = s_c.top - head;
-				//setString((char *)contextPop(len), len);
-				str = (char *)contextPop(len);
-				s_c.json = p;
-				return PARSE_OK;
-			case '\\':
-				ch = *p++;
-				switch (ch) {
-				case '"': PUTC('\"'); break;
-				case '\\': PUTC('\\'); break;
-				case 'b': PUTC('\b'); break;
-				case 'f': PUTC('\f'); break;
-				case 'r': PUTC('\r'); break;
-				case 't': PUTC('\t'); break;
-				case 'n': PUTC('\n'); break;
-				case '/': PUTC('/'); break;
-				case 'u':
-					unsigned u;
-					if (!parseHex4(p, u))
-						STRING_ERROR(PARSE_INVALID_UNICODE_HEX);
-					if (u >= 0xd800 && u <= 0xdbff) {
-						unsigned ul;
-						if ((*p++) == '\\' && (*p++) == 'u'
-							&& parseHex4(p, ul) && ul >= 0xdc00 && ul <= 0xdfff) {
-							u = 0x10000 | ((u & 0x7ff) << 10) | (ul & 0x3ff);
-						} else {
-							STRING_ERROR(PARSE_INVALID_UNICODE_SURROGATE);
-						}
-					}
-					encode_utf8(u);
-					break;
-				default: STRING_ERROR(PARSE_INVALID_STRING_ESCAPE);
-				}
-				break;
-			case '\0': STRING_ERROR(PARSE_MISS_QUOTATION_MARK);
-			default:
-				if (static_cast<unsigned char>(ch) < 0x20) {
-					STRING_ERROR(PARSE_INVALID_STRING_CHAR);
-				}
-				PUTC(ch);
-			}
+		/* x <= 0x1f unsigned  <=>  max(x, 0x1f) == 0x1f */
+		__m128i ctl = _mm_cmpeq_epi8(_mm_max_epu8(x, _mm_set1_epi8(0x1f)), _mm_set1_epi8(0x1f));
+		__m128i sp = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('"')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\\'))), ctl);
+		return _mm_movemask_epi8(sp);
+	}
+
+	static const char* skipWhitespaceSse2(const char *p, const char *end, bool padded)
+	{
+		/* compact input has at most one blank between tokens, do not pay for a vector then */
+		for (int i = 0; i < 2; ++i, ++p)
+			if (p == end || !isWhitespace(*p))
+				return p;
+		for (; padded ? p < end : end - p >= 16; p += 16) {
+			unsigned m = whitespaceMask16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+			if (m)
+				return p + ctz(m) < end ? p + ctz(m) : end;
 		}
+		return padded ? end : skipWhitespaceScalar(p, end, false);
 	}
 
-	ParseResult Value::parseString()
+	static const char* scanStringSse2(const char *p, const char *end, bool padded)
 	{
-		char *s;
-		size_t len;
-		ParseResult ret;
-		if ((ret = parseStringRaw(s, len)) == PARSE_OK) {
-			setString(s, len);
+		for (; padded ? p < end : end - p >= 16; p += 16) {
+			unsigned m = stringMask16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+			if (m)
+				return p + ctz(m) < end ? p + ctz(m) : end;
 		}
-		return ret;
+		return padded ? end : scanStringSwar(p, end, false);
 	}
 
-	ParseResult Value::parseArray()
+	AJ_TARGET_AVX2 static const char* skipWhitespaceAvx2(const char *p, const char *end, bool padded)
 	{
-		++s_c.json;
-		parseWhitespace();
-		if (*s_c.json == ']') {
-			++s_c.json;
-			freeMem();
-			m_type = VALUE_TYPE_ARRAY;
-			m_a.e = nullptr;
-			m_a.size = 0;
-			return PARSE_OK;
+		for (int i = 0; i < 2; ++i, ++p)
+			if (p == end || !isWhitespace(*p))
+				return p;
+		for (; padded ? p < end : end - p >= 32; p += 32) {
+			__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+			__m256i ws = _mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\t'))),
+				_mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\r'))));
+			unsigned m = ~static_cast<unsigned>(_mm256_movemask_epi8(ws));
+			if (m)
+				return p + ctz(m) < end ? p + ctz(m) : end;
 		}
+		if (padded)
+			return end;
+		/* leave the AVX state clean, the legacy-SSE tail would otherwise stall on every call */
+		_mm256_zeroupper();
+		return skipWhitespaceSse2(p, end, false);
+	}
 
-		size_t size = 0;
-		Value e;
-		ParseResult ret;
-		for (;;) {
-			if ((ret = e.parseValue()) != PARSE_OK) {
-				break;
-			}
-			memcpy(contextPush(sizeof(Value)), &e, sizeof(Value));
-			switch (e.m_type) {
-			case VALUE_TYPE_ARRAY:
-				e.m_a.e = nullptr;
-				break;
-			case VALUE_TYPE_STRING:
-				e.m_s.s = nullptr;
-				break;
-			case VALUE_TYPE_OBJECT:
-				e.m_o.m = nullptr;
-				break;
-			default:
-				break;
-			}
-			e.m_type = VALUE_TYPE_NULL;
-			++size;
-			parseWhitespace();
-			if (*s_c.json == ',') {
-				++s_c.json;
-				parseWhitespace();
-			} else if (*s_c.json == ']') {
-				++s_c.json;
-				freeMem();
-				m_type = VALUE_TYPE_ARRAY;
-				m_a.size = size;
-				size *= sizeof(Value);
-				memcpy(m_a.e = (Value *)malloc(size), contextPop(size), size);
-				return PARSE_OK;
-			} else {				
-				ret = PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
-				break;
-			}
+	AJ_TARGET_AVX2 static const char* scanStringAvx2(const char *p, const char *end, bool padded)
+	{
+		for (; padded ? p < end : end - p >= 32; p += 32) {
+			__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+			__m256i ctl = _mm256_cmpeq_epi8(_mm256_max_epu8(x, _mm256_set1_epi8(0x1f)), _mm256_set1_epi8(0x1f));
+			__m256i sp = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')),
+				_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\\'))), ctl);
+			unsigned m = static_cast<unsigned>(_mm256_movemask_epi8(sp));
+			if (m)
+				return p + ctz(m) < end ? p + ctz(m) : end;
 		}
+		if (padded)
+			return end;
+		/* leave the AVX state clean, the legacy-SSE tail would otherwise stall on every call */
+		_mm256_zeroupper();
+		return scanStringSse2(p, end, false);
+	}
 
-		for (size_t i = 0; i < size; ++i) {
-			((Value *)contextPop(sizeof(Value)))->freeMem();
+	static SimdLevel detectSimd()
+	{
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] >= 7) {
+			__cpuidex(info, 7, 0);
+			bool avx2 = (info[1] & (1 << 5)) != 0;
+			__cpuid(info, 1);
+			bool osxsave = (info[2] & (1 << 27)) != 0;
+			if (avx2 && osxsave && (_xgetbv(0) & 6) == 6)
+				return SIMD_AVX2;
 		}
-		return ret;
+		return SIMD_SSE2;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") ? SIMD_AVX2 : SIMD_SSE2;
+#endif
+	}
+#else
+	static SimdLevel detectSimd()
+	{
+		return SIMD_NONE;
 	}
+#endif
 
-	ParseResult Value::parseObject()
+	static SimdLevel supportedSimd()
 	{
-		++s_c.json;
-		parseWhitespace();
-		if (*s_c.json == '}') {
-			++s_c.json;
-			freeMem();
-			m_type = VALUE_TYPE_OBJECT;
-			m_o.m = nullptr;
-			m_o.size = 0;
-			return PARSE_OK;
+		static const SimdLevel level = detectSimd();
+		return level;
+	}
+
+	static std::atomic<int> s_simd(-1);
+
+	SimdLevel simdLevel()
+	{
+		int level = s_simd.load(std::memory_order_relaxed);
+		if (level < 0)
+			s_simd.store(level = supportedSimd(), std::memory_order_relaxed);
+		return static_cast<SimdLevel>(level);
+	}
+
+	SimdLevel setSimdLevel(SimdLevel level)
+	{
+		if (level > supportedSimd())
+			level = supportedSimd();
+		s_simd.store(level, std::memory_order_relaxed);
+		return level;
+	}
+
+	static inline const char* skipWhitespace(const char *p, const char *end, bool padded)
+	{
+#ifdef AJ_SIMD_X86
+		switch (simdLevel()) {
+		case SIMD_AVX2: return skipWhitespaceAvx2(p, end, padded);
+		case SIMD_SSE2: return skipWhitespaceSse2(p, end, padded);
+		default: break;
 		}
+#endif
+		return skipWhitespaceScalar(p, end, padded);
+	}
 
-		size_t size = 0;
-		Member m;
-		ParseResult ret;
-		for (;;) {
-			char *k;
-			size_t klen;
-			if ((ret = parseStringRaw(k, klen)) != PARSE_OK) {
-				ret = PARSE_MISS_KEY;
-				break;
-			}
-			m.k = (char *)malloc(sizeof(char) * (klen + 1));
-			memcpy(m.k, k, klen);
-			m.k[klen] = '\0';
-			m.klen = klen;
-			parseWhitespace();
-			if (*s_c.json != ':') {
-				ret = PARSE_MISS_COLON;
-				free(m.k);
-				break;
-			}
-			++s_c.json;
-			parseWhitespace();
+	static inline const char* scanString(const char *p, const char *end, bool padded)
+	{
+#ifdef AJ_SIMD_X86
+		switch (simdLevel()) {
+		case SIMD_AVX2: return scanStringAvx2(p, end, padded);
+		case SIMD_SSE2: return scanStringSse2(p, end, padded);
+		default: break;
+		}
+#endif
+		return scanStringSwar(p, end, padded);
+	}
 
-			if ((ret = m.v.parseValue()) != PARSE_OK) {
-				free(m.k);
-				break;
-			}
-			memcpy(contextPush(sizeof(Member)), &m, sizeof(Member));
-			switch (m.v.m_type) {
-			case VALUE_TYPE_ARRAY:
-				m.v.m_a.e = nullptr;
-				break;
-			case VALUE_TYPE_STRING:
-				m.v.m_s.s = nullptr;
-				break;
-			case VALUE_TYPE_OBJECT:
-				m.v.m_o.m = nullptr;
-				break;
-			default:
-				break;
-			}
-			m.v.m_type = VALUE_TYPE_NULL;
-			++size;
-			parseWhitespace();
-			if (*s_c.json == ',') {
-				++s_c.json;
-				parseWhitespace();
-			} else if (*s_c.json == '}') {
-				++s_c.json;
-				freeMem();
-				m_type = VALUE_TYPE_OBJECT;
-				m_o.size = size;
-				size *= sizeof(Member);
-				memcpy(m_o.m = (Member *)malloc(size), contextPop(size), size);
-				return PARSE_OK;
-			} else {
-				ret = PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+	/*
+	 * Stage one of Tape::parse: classify 64-byte blocks into bitmasks, one
+	 * bit per byte, then find the structural positions with bit arithmetic.
+	 */
+	struct BlockClass {
+		uint64_t quote, backslash, op, ws;	/* op: { } [ ] : , */
+	};
+
+	/* what one block leaves for the next */
+	struct StructuralCarry {
+		bool escaped = false;		/* the next block starts with an escaped byte */
+		uint64_t inString = 0;		/* all ones while inside a string */
+		uint64_t scalar = 0;		/* the last byte was inside a number or literal */
+	};
+
+	static inline unsigned ctz64(uint64_t mask)
+	{
+#ifdef _MSC_VER
+		unsigned long i;
+		_BitScanForward64(&i, mask);
+		return i;
+#else
+		return __builtin_ctzll(mask);
+#endif
+	}
+
+	/* bit i is the parity of the set bits at or below i */
+	static inline uint64_t prefixXor(uint64_t x)
+	{
+		x ^= x << 1;
+		x ^= x << 2;
+		x ^= x << 4;
+		x ^= x << 8;
+		x ^= x << 16;
+		x ^= x << 32;
+		return x;
+	}
+
+	static inline uint32_t* structurals(const BlockClass &b, StructuralCarry &carry, uint32_t base, uint32_t *out)
+	{
+		/* a backslash escapes the next byte unless it is escaped itself; runs are rare, walk them */
+		uint64_t escaped = 0;
+		uint64_t bs = b.backslash;
+		if (carry.escaped) {
+			escaped = 1;
+			bs &= ~uint64_t(1);
+		}
+		carry.escaped = false;
+		while (bs) {
+			unsigned i = ctz64(bs);
+			if (i == 63) {
+				carry.escaped = true;
 				break;
 			}
+			escaped |= uint64_t(2) << i;
+			bs &= ~(uint64_t(3) << i);
 		}
 
-		for (size_t i = 0; i < size; ++i) {
-			auto p = (Member *)contextPop(sizeof(Member));
-			free(p->k);
-			p->v.freeMem();
-		}
-		return ret;
+		/* from an opening quote up to, not including, its closing one */
+		uint64_t quote = b.quote & ~escaped;
+		uint64_t inString = prefixXor(quote) ^ carry.inString;
+		carry.inString = static_cast<uint64_t>(static_cast<int64_t>(inString) >> 63);
+
+		uint64_t scalar = ~(b.op | b.ws | quote | inString);
+		uint64_t scalarStart = scalar & ~(scalar << 1 | carry.scalar);
+		carry.scalar = scalar >> 63;
+
+		uint64_t bits = (b.op & ~inString) | (quote & inString) | scalarStart;
+		for (; bits; bits &= bits - 1)
+			*out++ = base + ctz64(bits);
+		return out;
 	}
 
-	StringifyResult Value::stringifyValue() const
+	static void classifyScalar(const char *p, BlockClass &b)
 	{
-		switch (m_type) {
-		case VALUE_TYPE_NULL:PUTS("null", 4); break;
-		case VALUE_TYPE_FALSE:PUTS("false", 5); break;
-		case VALUE_TYPE_TRUE:PUTS("true", 4); break;
-		case VALUE_TYPE_NUMBER: 
-			s_c.top -= 32 - sprintf(static_cast<char *>(contextPush(32)), "%.17g", m_n);
-			break;
-		case VALUE_TYPE_ARRAY:
-			PUTC('[');
-			for (size_t i = 0; i < m_a.size; i++) {
-				if (i > 0) PUTC(',');
-				StringifyResult ret = m_a.e[i].stringifyValue();
-				if (ret != STRINGIFY_OK)return ret;
+		b.quote = b.backslash = b.op = b.ws = 0;
+		for (int i = 0; i < 64; ++i) {
+			uint64_t bit = uint64_t(1) << i;
+			switch (p[i]) {
+			case '"': b.quote |= bit; break;
+			case '\\': b.backslash |= bit; break;
+			case '{': case '}': case '[': case ']': case ':': case ',': b.op |= bit; break;
+			case ' ': case '\t': case '\n': case '\r': b.ws |= bit; break;
+			default: break;
 			}
-			PUTC(']');
-			break;
-		case VALUE_TYPE_STRING: stringifyString(m_s.s, m_s.len); break;
-		case VALUE_TYPE_OBJECT:
-			PUTC('{');
-			for (size_t i = 0; i < m_o.size; i++) {
-				if (i > 0) PUTC(',');
-				stringifyString(m_o.m[i].k, m_o.m[i].klen);
-				PUTC(':');
-				m_o.m[i].v.stringifyValue();
-			}			
-			PUTC('}');
-			break;
 		}
-		return STRINGIFY_OK;
 	}
 
-	StringifyResult Value::stringifyString(const char *s, size_t len) const
+	static uint32_t* indexBlocksScalar(const char *p, size_t blocks, StructuralCarry &carry, uint32_t *out)
 	{
-		assert(s != nullptr);
-		assert(len > 0);
-		PUTC('"');
-		const char *p = s;
-		for (size_t i = 0; i < len; i++) {
-			char ch = *p++;
-			if (ch < 0x20) {
-				char ustr[6] = { '\\','u' };
-				ustr[2] = s_table[(ch >> 12) & 0xf];
-				ustr[3] = s_table[(ch >> 8) & 0xf];
-				ustr[4] = s_table[(ch >> 4) & 0xf];
-				ustr[5] = s_table[ch & 0xf];
-				PUTS(ustr, 6);
-			} else {
-				switch (ch) {
-				case '\"': PUTS("\\\"", 2); break;
-				case '\\': PUTS("\\\\", 2); break;
-				case '\b': PUTS("\\b", 2); break;
-				case '\f': PUTS("\\f", 2); break;
-				case '\r': PUTS("\\r", 2); break;
-				case '\t': PUTS("\\t", 2); break;
-				case '\n': PUTS("\\n", 2); break;
-				default: PUTC(ch); break;
-				}
-			}		
-		}
-		PUTC('"');
-		return STRINGIFY_OK;
+		for (size_t i = 0; i < blocks; ++i) {
+			BlockClass b;
+			classifyScalar(p + i * 64, b);
+			out = structurals(b, carry, static_cast<uint32_t>(i * 64), out);
+		}
+		return out;
 	}
 
-	void Value::freeMem()
+#ifdef AJ_SIMD_X86
+	static uint32_t* indexBlocksSse2(const char *p, size_t blocks, StructuralCarry &carry, uint32_t *out)
 	{
-		switch (m_type) {
-		case VALUE_TYPE_STRING:free(m_s.s); break;
-		case VALUE_TYPE_ARRAY:
-			for (size_t i = 0; i < m_a.size; ++i)
-				(m_a.e + i)->freeMem();
-			free(m_a.e);
-			break;
-		case VALUE_TYPE_OBJECT:
-			for (size_t i = 0; i < m_o.size; ++i) {
-				(m_o.m + i)->v.freeMem();
-				free((m_o.m + i)->k);
+		for (size_t i = 0; i < blocks; ++i) {
+			BlockClass b = { 0, 0, 0, 0 };
+			for (int j = 0; j < 4; ++j) {
+				__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i * 64 + j * 16));
+				/* '[' and '{', ']' and '}' differ only in bit 5 */
+				__m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+				__m128i op = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('{')), _mm_cmpeq_epi8(lower, _mm_set1_epi8('}'))),
+					_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(':')), _mm_cmpeq_epi8(x, _mm_set1_epi8(','))));
+				b.quote |= uint64_t(_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('"')))) << (j * 16);
+				b.backslash |= uint64_t(_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('\\')))) << (j * 16);
+				b.op |= uint64_t(_mm_movemask_epi8(op)) << (j * 16);
+				b.ws |= uint64_t(~whitespaceMask16(x) & 0xffff) << (j * 16);
 			}
-			free(m_o.m);
-			break;
-		default:
-			break;
+			out = structurals(b, carry, static_cast<uint32_t>(i * 64), out);
 		}
+		return out;
+	}
 
-		m_type = VALUE_TYPE_NULL;
+	AJ_TARGET_AVX2 static uint32_t* indexBlocksAvx2(const char *p, size_t blocks, StructuralCarry &carry, uint32_t *out)
+	{
+		for (size_t i = 0; i < blocks; ++i) {
+			BlockClass b = { 0, 0, 0, 0 };
+			for (int j = 0; j < 2; ++j) {
+				__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i * 64 + j * 32));
+				__m256i lower = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+				__m256i op = _mm256_or_si256(
+					_mm256_or_si256(_mm256_cmpeq_epi8(lower, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('}'))),
+					_mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(':')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8(','))));
+				__m256i ws = _mm256_or_si256(
+					_mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\t'))),
+					_mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\r'))));
+				b.quote |= uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('"'))))) << (j * 32);
+				b.backslash |= uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\\'))))) << (j * 32);
+				b.op |= uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(op))) << (j * 32);
+				b.ws |= uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(ws))) << (j * 32);
+			}
+			out = structurals(b, carry, static_cast<uint32_t>(i * 64), out);
+		}
+		_mm256_zeroupper();
+		return out;
 	}
+#endif
 
-	void* Value::contextPush(size_t size)
+	/* every structural position of [p, p + len) in order; out needs room for len + 1 */
+	static size_t indexStructurals(const char *p, size_t len, uint32_t *out)
 	{
-		assert(size > 0);
-		if (s_c.top + size >= s_c.size) {
-			if (s_c.size == 0)
-				s_c.size = AJ_PARSE_STACK_INIT_SIZE;
-			while (s_c.top + size > s_c.size)
-				s_c.size += s_c.size >> 1;
-			s_c.stack = (char *)realloc(s_c.stack, s_c.size);
+		StructuralCarry carry;
+		uint32_t *q = out;
+		size_t blocks = len / 64;
+#ifdef AJ_SIMD_X86
+		switch (simdLevel()) {
+		case SIMD_AVX2: q = indexBlocksAvx2(p, blocks, carry, q); break;
+		case SIMD_SSE2: q = indexBlocksSse2(p, blocks, carry, q); break;
+		default: q = indexBlocksScalar(p, blocks, carry, q); break;
 		}
-		void* res = s_c.stack + s_c.top;
-		s_c.top += size;
-		return res;
+#else
+		q = indexBlocksScalar(p, blocks, carry, q);
+#endif
+		if (len % 64) {
+			/* the tail, padded with blanks */
+			char tail[64];
+			memset(tail, ' ', sizeof(tail));
+			memcpy(tail, p + blocks * 64, len % 64);
+			BlockClass b;
+			classifyScalar(tail, b);
+			q = structurals(b, carry, static_cast<uint32_t>(blocks * 64), q);
+		}
+		return q - out;
 	}
 
-	void* Value::contextPop(size_t size)
+	ParseResult Value::parse(const char *s, size_t len, unsigned flags)
 	{
-		assert(s_c.top >= size);
-		return s_c.stack + (s_c.top -= size);
+		Context c;
+		c.padded = (flags & PARSE_FLAG_PADDED) != 0;
+		return parse(c, s, len);
 	}
 
-	bool Value::parseHex4(const char*& p, unsigned& u)
+	ParseResult Value::parseInsitu(char *s, size_t len, unsigned flags)
 	{
-		u = 0;
-		for (auto i = 0; i < 4; ++i) {
-			u <<= 4;
-			char ch = *p++;
-			if (ch >= '0' && ch <= '9')
-				u += ch - '0';
-			else if (ch >= 'a' && ch <= 'f')
-				u += ch - 'a' + 10;
-			else if (ch >= 'A' && ch <= 'F')
-				u += ch - 'A' + 10;
-			else
-				return false;
-		}
-		return true;
+		Context c;
+		c.insitu = true;
+		c.padded = (flags & PARSE_FLAG_PADDED) != 0;
+		return parse(c, s, len);
 	}
 
-	void Value::encode_utf8(unsigned u)
+	ParseResult parse(Handler &h, const char *s, size_t len, unsigned flags)
 	{
-		if (u < 0x80) {
-			PUTC(0x7f & u);
-		} else if (u < 0x800) {
-			PUTC(0xc0 | ((u >> 6) & 0x1f));
-			PUTC(0x80 | (u & 0x3f));
-		} else if (u < 0x10000) {
-			PUTC(0xe0 | ((u >> 12) & 0x0f));
-			PUTC(0x80 | ((u >> 6) & 0x3f));
-			PUTC(0x80 | (u & 0x3f));
-		} else {
-			PUTC(0xf0 | ((u >> 18) & 0x03));
-			PUTC(0x80 | ((u >> 12) & 0x3f));
-			PUTC(0x80 | ((u >> 6) & 0x3f));
-			PUTC(0x80 | (u & 0x3f));
+		Context c;
+		c.padded = (flags & PARSE_FLAG_PADDED) != 0;
+		return Value::parseDocument(c, h, s, len);
+	}
+
+	ParseResult parseInsitu(Handler &h, char *s, size_t len, unsigned flags)
+	{
+		Context c;
+		c.insitu = true;
+		c.padded = (flags & PARSE_FLAG_PADDED) != 0;
+		return Value::parseDocument(c, h, s, len);
+	}
+
+	/*
+	 * Objects of AJ_OBJECT_INDEX_MIN members or more carry room for an
+	 * open-addressing table right after their members, in the same
+	 * allocation, so it goes away with them however they were allocated.
+	 * The first lookup fills it; until then, or while another thread is
+	 * filling it, lookups scan.
+	 */
+	static uint32_t hashKey(const char *key, size_t len)
+	{
+		uint32_t h = 2166136261u;	/* FNV-1a */
+		for (size_t i = 0; i < len; ++i)
+			h = (h ^ static_cast<unsigned char>(key[i])) * 16777619u;
+		return h;
+	}
+
+	struct ObjectIndex {
+		enum { EMPTY, BUILDING, READY };
+		std::atomic<int> state;
+		uint32_t mask;
+		uint32_t slots[1];	/* mask + 1 of them: member index + 1, 0 when free */
+
+		static size_t capacity(size_t members)
+		{
+			size_t n = 2;
+			while (n < members * 2)
+				n <<= 1;
+			return n;
+		}
+		static size_t bytes(size_t members)
+		{
+			return offsetof(ObjectIndex, slots) + sizeof(uint32_t) * capacity(members);
+		}
+		static ObjectIndex* of(Member *m, size_t members)
+		{
+			return reinterpret_cast<ObjectIndex *>(m + members);
 		}
+		void init(size_t members)
+		{
+			new (&state) std::atomic<int>(EMPTY);
+			mask = static_cast<uint32_t>(capacity(members) - 1);
+		}
+		/* false if another thread is at it, the caller then scans */
+		bool build(const Member *m, size_t members)
+		{
+			int expected = EMPTY;
+			if (!state.compare_exchange_strong(expected, BUILDING, std::memory_order_acquire))
+				return expected == READY;
+			memset(slots, 0, sizeof(uint32_t) * (mask + 1));
+			for (size_t i = 0; i < members; ++i)
+				add(m, i);
+			state.store(READY, std::memory_order_release);
+			return true;
+		}
+		void add(const Member *m, size_t i)
+		{
+			uint32_t s = hashKey(m[i].key(), m[i].keyLength()) & mask;
+			for (; slots[s] != 0; s = (s + 1) & mask) {
+				const Member &o = m[slots[s] - 1];
+				if (o.keyLength() == m[i].keyLength() && memcmp(o.key(), m[i].key(), o.keyLength()) == 0)
+					return;	/* a duplicate key: the first one wins, as for a scan */
+			}
+			slots[s] = static_cast<uint32_t>(i + 1);
+		}
+		const Member* find(const Member *m, const char *key, size_t len) const
+		{
+			for (uint32_t s = hashKey(key, len) & mask; slots[s] != 0; s = (s + 1) & mask) {
+				const Member &o = m[slots[s] - 1];
+				if (o.keyLength() == len && (o.key() == key || memcmp(o.key(), key, len) == 0))
+					return &o;
+			}
+			return nullptr;
+		}
+	};
+
+	static size_t membersBytes(size_t members)
+	{
+		size_t n = sizeof(Member) * members;
+		return members >= AJ_OBJECT_INDEX_MIN ? n + ObjectIndex::bytes(members) : n;
+	}
+
+	/*
+	 * Containers built in code (VALUE_FLAG_CAPACITY) live in a block that
+	 * starts with their capacity, which places an object's index; parsed
+	 * ones are exactly full.
+	 */
+	static const size_t CAPACITY_HEADER = sizeof(size_t);
+
+	static void* allocWithCapacity(size_t capacity, size_t bytes)
+	{
+		char *p = static_cast<char *>(malloc(CAPACITY_HEADER + bytes));
+		*reinterpret_cast<size_t *>(p) = capacity;
+		return p + CAPACITY_HEADER;
+	}
+
+	static size_t capacityOf(const void *elements)
+	{
+		return reinterpret_cast<const size_t *>(elements)[-1];
+	}
+
+	static void freeElements(void *elements, bool header)
+	{
+		free(header ? static_cast<char *>(elements) - CAPACITY_HEADER : elements);
+	}
+
+	/*
+	 * Finished values wait on the context stack until their container
+	 * closes, then move into one allocation; an object's keys sit there as
+	 * string values in front of their values.
+	 */
+	struct Value::Builder {
+		Context &c;
+
+		explicit Builder(Context &c) : c(c) {}
+
+		/*
+		 * A length or count the layout can hold, 32 bits of it with
+		 * AJ_COMPACT_VALUE. Anything else is refused, and Value::parse()
+		 * reports the refusal as PARSE_INPUT_TOO_LARGE.
+		 */
+		static bool fits(size_t n) { return n <= std::numeric_limits<Size>::max(); }
+
+		Value* push(ValueType type)
+		{
+			Value *v = new (c.push(sizeof(Value))) Value;
+			v->m_type = type;
+			return v;
+		}
+		bool onNull() { push(VALUE_TYPE_NULL); return true; }
+		bool onBool(bool b) { push(b ? VALUE_TYPE_TRUE : VALUE_TYPE_FALSE); return true; }
+		bool onNumber(double d) { push(VALUE_TYPE_NUMBER)->m_n = d; return true; }
+		bool onInt64(int64_t i) { push(VALUE_TYPE_INT64)->m_i = i; return true; }
+		bool onUint64(uint64_t u) { push(VALUE_TYPE_UINT64)->m_u = u; return true; }
+		bool onString(const char *s, size_t len)
+		{
+			if (!fits(len))
+				return false;
+			/* a copied string is scratch just above the stack top: take it before pushing */
+#ifdef AJ_COMPACT_VALUE
+			if (len <= INLINE_MAX && !c.insitu) {
+				char chars[INLINE_MAX];
+				if (len > 0)
+					memcpy(chars, s, len);
+				push(VALUE_TYPE_STRING)->setInline(chars, len);
+				return true;
+			}
+#endif
+			char *str = const_cast<char *>(s);
+			unsigned char flags = VALUE_FLAG_BORROWED;
+			if (!c.insitu) {
+				str = static_cast<char *>(c.alloc(sizeof(char) * (len + 1)));
+				/* an empty string may come from an empty stack, s null */
+				if (len > 0)
+					memcpy(str, s, len);
+				str[len] = '\0';
+				flags = c.arena ? VALUE_FLAG_ARENA : 0;
+			}
+			Value *v = push(VALUE_TYPE_STRING);
+			v->m_s.s = str;
+			v->m_s.len = static_cast<Size>(len);
+			v->m_flags = flags;
+			return true;
+		}
+		bool onStartObject() { return true; }
+		bool onKey(const char *s, size_t len)
+		{
+			if (!fits(len))
+				return false;
+#ifdef AJ_COMPACT_VALUE
+			if (!c.keys || len <= INLINE_MAX)
+#else
+			if (!c.keys)
+#endif
+				return onString(s, len);
+			char *k = const_cast<char *>(c.keys->intern(s, len));
+			Value *v = push(VALUE_TYPE_STRING);
+			v->m_s.s = k;
+			v->m_s.len = static_cast<Size>(len);
+			v->m_flags = VALUE_FLAG_BORROWED;
+			return true;
+		}
+		bool onEndObject(size_t size)
+		{
+			if (!fits(size))
+				return false;
+			Member *m = nullptr;
+			if (size > 0) {
+				m = static_cast<Member *>(c.alloc(membersBytes(size)));
+				if (size >= AJ_OBJECT_INDEX_MIN)
+					ObjectIndex::of(m, size)->init(size);
+				Value *kv = static_cast<Value *>(c.pop(sizeof(Value) * 2 * size));
+				for (size_t i = 0; i < size; ++i, kv += 2) {
+#ifdef AJ_COMPACT_VALUE
+					relocate(&m[i].kv, &kv[0], 1);
+#else
+					m[i].k = kv[0].m_s.s;
+					m[i].klen = kv[0].m_s.len;
+#endif
+					relocate(&m[i].v, &kv[1], 1);
+				}
+			}
+			Value *v = push(VALUE_TYPE_OBJECT);
+			v->m_o.m = m;
+			v->m_o.size = static_cast<Size>(size);
+			v->m_flags = (c.arena ? VALUE_FLAG_ARENA : 0) | (c.insitu || c.keys ? VALUE_FLAG_BORROWED : 0);
+			return true;
+		}
+		bool onStartArray() { return true; }
+		bool onEndArray(size_t size)
+		{
+			if (!fits(size))
+				return false;
+			Value *e = nullptr;
+			if (size > 0) {
+				e = static_cast<Value *>(c.alloc(sizeof(Value) * size));
+				relocate(e, static_cast<Value *>(c.pop(sizeof(Value) * size)), size);
+			}
+			Value *v = push(VALUE_TYPE_ARRAY);
+			v->m_a.e = e;
+			v->m_a.size = static_cast<Size>(size);
+			v->m_flags = c.arena ? VALUE_FLAG_ARENA : 0;
+			return true;
+		}
+	};
+
+	static thread_local ParseError s_lastError;
+
+	const ParseError& lastParseError()
+	{
+		return s_lastError;
+	}
+
+	/* the bytes of json's line around at, up to width on either side */
+	static void errorWindow(const char *json, size_t len, size_t at, size_t width, size_t &lo, size_t &hi)
+	{
+		lo = at;
+		while (lo > 0 && at - lo < width && json[lo - 1] != '\n' && json[lo - 1] != '\r')
+			--lo;
+		hi = at;
+		while (hi < len && hi - at <= width && json[hi] != '\n' && json[hi] != '\r')
+			++hi;
+	}
+
+	/* the only pass over the input a failure costs; lines end as errorWindow() has them */
+	void ParseError::fail(ParseResult result, const char *json, size_t len, size_t offset)
+	{
+		ParseError &e = s_lastError;
+		e.m_result = result;
+		e.m_offset = offset;
+		e.m_line = e.m_column = 0;
+		e.m_window.clear();
+		e.m_windowAt = 0;
+		if (json == nullptr)
+			return;
+		size_t start = 0;
+		e.m_line = 1;
+		for (size_t i = 0; i < offset; ++i)
+			if (json[i] == '\n' || json[i] == '\r') {
+				if (json[i] == '\n' || i + 1 == len || json[i + 1] != '\n')
+					++e.m_line;
+				start = i + 1;
+			}
+		e.m_column = offset - start + 1;
+		size_t lo, hi;
+		errorWindow(json, len, offset, 256, lo, hi);
+		e.m_window.assign(json + lo, hi - lo);
+		e.m_windowAt = offset - lo;
+	}
+
+	std::string ParseError::snippet(size_t width) const
+	{
+		if (m_line == 0)
+			return std::string();
+		size_t lo, hi;
+		errorWindow(m_window.data(), m_window.size(), m_windowAt, width, lo, hi);
+		std::string s(m_window.data() + lo, hi - lo);
+		/* one column per byte, so the caret lines up */
+		for (char &ch : s)
+			if (static_cast<unsigned char>(ch) < 0x20)
+				ch = ' ';
+		s += '\n';
+		s.append(m_windowAt - lo, ' ');
+		s += '^';
+		return s;
+	}
+
+	ParseResult Value::parseFile(const char *path)
+	{
+		MappedFile f;
+		if (!f.open(path)) {
+			freeMem();
+			ParseError::fail(PARSE_FILE_ERROR, nullptr, 0, 0);
+			return PARSE_FILE_ERROR;
+		}
+		return parse(f.data(), f.size(), f.padded() ? PARSE_FLAG_PADDED : PARSE_FLAG_NONE);
+	}
+
+	ParseResult Value::parse(Context &c, const char *s, size_t len)
+	{
+		freeMem();
+		Builder b(c);
+		ParseResult res = parseDocument(c, b, s, len);
+		if (res == PARSE_ABORTED) {
+			/* the Builder only stops at what the layout cannot hold */
+			res = PARSE_INPUT_TOO_LARGE;
+			ParseError::fail(res, s, len, s_lastError.m_offset);
+		}
+		if (res == PARSE_OK) {
+			relocate(this, static_cast<Value *>(c.pop(sizeof(Value))), 1);
+		} else {
+			/* only finished values are left on the stack: keys, elements and a non-singular root */
+			while (c.top > 0)
+				static_cast<Value *>(c.pop(sizeof(Value)))->freeMem();
+		}
+		assert(c.top == 0);
+		return res;
+	}
+
+	/* ws value ws */
+	template <typename H>
+	ParseResult Value::parseDocument(Context &c, H &h, const char *s, size_t len)
+	{
+		assert(s != nullptr || len == 0);
+		c.json = s;
+		c.end = s + len;
+		c.top = c.peak = 0;
+		parseWhitespace(c);
+		ParseResult res = parseValue(c, h);
+		if (res == PARSE_OK) {
+			parseWhitespace(c);
+			if (c.json != c.end)
+				res = PARSE_ROOT_NOT_SINGULAR;
+		}
+		if (res != PARSE_OK)
+			ParseError::fail(res, s, len, c.json - s);
+		return res;
+	}
+
+	void Value::setString(const char *s, size_t len)
+	{
+		assert(s != nullptr || len == 0);
+		freeMem();
+#ifdef AJ_COMPACT_VALUE
+		/* more than 32 bits of length cannot be stored: the value stays null */
+		assert(len <= UINT32_MAX);
+		if (len > UINT32_MAX)
+			return;
+		if (len <= INLINE_MAX) {
+			setInline(s, len);
+			return;
+		}
+#endif
+		m_s.s = (char *)malloc(sizeof(char) * (len + 1));
+		memcpy(m_s.s, s, len);
+		m_s.s[len] = '\0';
+		m_s.len = static_cast<Size>(len);
+		m_type = VALUE_TYPE_STRING;
+	}
+
+#ifdef AJ_COMPACT_VALUE
+	static_assert(sizeof(Value) == 16, "AJ_COMPACT_VALUE layout");
+
+	void Value::setInline(const char *s, size_t len)
+	{
+		assert(len <= INLINE_MAX);
+		char *p = inlineChars();
+		memcpy(p, s, len);
+		p[len] = '\0';
+		p[INLINE_MAX] = static_cast<char>(INLINE_MAX - len);
+		m_type = VALUE_TYPE_STRING;
+		m_flags = VALUE_FLAG_INLINE;
+	}
+#endif
+
+	Value::Value(Value &&v) noexcept
+	{
+		if (v.m_flags & VALUE_FLAG_ARENA) {
+			copyFrom(v);
+		} else {
+			relocate(this, &v, 1);
+			v.m_type = VALUE_TYPE_NULL;
+			v.m_flags = 0;
+		}
+	}
+
+	void Value::swap(Value &v) noexcept
+	{
+		alignas(Value) unsigned char t[sizeof(Value)];
+		memcpy(t, static_cast<void *>(this), sizeof(Value));
+		relocate(this, &v, 1);
+		memcpy(static_cast<void *>(&v), t, sizeof(Value));
+	}
+
+	Value Value::deepCopy() const
+	{
+		Value v;
+		v.copyFrom(*this);
+		return v;
+	}
+
+	/* a value's contents are plain bytes; nothing refers back to where it lives */
+	void Value::relocate(Value *dst, Value *src, size_t n)
+	{
+		if (n > 0)
+			memmove(static_cast<void *>(dst), static_cast<const void *>(src), sizeof(Value) * n);
+	}
+
+	/*
+	 * this is null; the copy owns everything, so carries no flags. Copied
+	 * containers start out with null children, filled in a level at a time.
+	 */
+	void Value::copyFrom(const Value &v)
+	{
+		struct Level { Value *dst; const Value *src; size_t i; };
+		LevelStack<Level> open;
+		Value *d = this;
+		const Value *s = &v;
+		for (;;) {
+			switch (s->m_type) {
+			case VALUE_TYPE_STRING:
+				d->setString(s->getString(), s->getStringLength());
+				break;
+			case VALUE_TYPE_ARRAY: {
+				const size_t size = s->m_a.size;
+				Value *e = nullptr;
+				if (size > 0) {
+					e = static_cast<Value *>(malloc(sizeof(Value) * size));
+					for (size_t i = 0; i < size; ++i)
+						new (e + i) Value;
+					open.push(Level{ d, s, 0 });
+				}
+				d->m_a.e = e;
+				d->m_a.size = s->m_a.size;
+				d->m_type = VALUE_TYPE_ARRAY;
+				break;
+			}
+			case VALUE_TYPE_OBJECT: {
+				const size_t size = s->m_o.size;
+				Member *m = nullptr;
+				if (size > 0) {
+					m = static_cast<Member *>(malloc(membersBytes(size)));
+					if (size >= AJ_OBJECT_INDEX_MIN)
+						ObjectIndex::of(m, size)->init(size);
+					for (size_t i = 0; i < size; ++i) {
+						const Member &o = s->m_o.m[i];
+#ifdef AJ_COMPACT_VALUE
+						(new (&m[i].kv) Value)->copyFrom(o.kv);
+#else
+						m[i].k = static_cast<char *>(malloc(sizeof(char) * (o.klen + 1)));
+						memcpy(m[i].k, o.k, o.klen);
+						m[i].k[o.klen] = '\0';
+						m[i].klen = o.klen;
+#endif
+						new (&m[i].v) Value;
+					}
+					open.push(Level{ d, s, 0 });
+				}
+				d->m_o.m = m;
+				d->m_o.size = static_cast<Size>(size);
+				d->m_type = VALUE_TYPE_OBJECT;
+				break;
+			}
+			default:
+				d->m_u = s->m_u;
+				d->m_type = s->m_type;
+				break;
+			}
+
+			/* on to the next child still to fill, past the containers that are done */
+			for (;;) {
+				if (open.empty())
+					return;
+				Level &l = open.top();
+				if (l.src->m_type == VALUE_TYPE_ARRAY) {
+					if (l.i == l.src->m_a.size) {
+						open.pop();
+						continue;
+					}
+					d = l.dst->m_a.e + l.i;
+					s = l.src->m_a.e + l.i;
+				} else {
+					if (l.i == l.src->m_o.size) {
+						open.pop();
+						continue;
+					}
+					d = &l.dst->m_o.m[l.i].v;
+					s = &l.src->m_o.m[l.i].v;
+				}
+				++l.i;
+				break;
+			}
+		}
+	}
+
+	void Value::setArray(size_t capacity)
+	{
+		freeMem();
+		m_a.e = nullptr;
+		m_a.size = 0;
+		m_type = VALUE_TYPE_ARRAY;
+		if (capacity > 0)
+			growArray(capacity);
+	}
+
+	size_t Value::getArrayCapacity() const
+	{
+		assert(m_type == VALUE_TYPE_ARRAY);
+		return m_flags & VALUE_FLAG_CAPACITY ? capacityOf(m_a.e) : m_a.size;
+	}
+
+	Value& Value::pushBack(Value &&v)
+	{
+		assert(m_type == VALUE_TYPE_ARRAY && !(m_flags & VALUE_FLAG_ARENA));
+		Value t(std::move(v));	/* v may be one of the elements about to move */
+		if (m_a.size == getArrayCapacity())
+			growArray(grown());
+		return *new (m_a.e + m_a.size++) Value(std::move(t));
+	}
+
+	Value& Value::insert(size_t index, Value &&v)
+	{
+		assert(m_type == VALUE_TYPE_ARRAY && !(m_flags & VALUE_FLAG_ARENA));
+		assert(index <= m_a.size);
+		Value t(std::move(v));
+		if (m_a.size == getArrayCapacity())
+			growArray(grown());
+		relocate(m_a.e + index + 1, m_a.e + index, m_a.size - index);
+		++m_a.size;
+		return *new (m_a.e + index) Value(std::move(t));
+	}
+
+	void Value::popBack()
+	{
+		assert(m_type == VALUE_TYPE_ARRAY && !(m_flags & VALUE_FLAG_ARENA));
+		assert(m_a.size > 0);
+		m_a.e[--m_a.size].freeMem();
+	}
+
+	void Value::erase(size_t index, size_t count)
+	{
+		assert(m_type == VALUE_TYPE_ARRAY && !(m_flags & VALUE_FLAG_ARENA));
+		assert(index <= m_a.size && count <= m_a.size - index);
+		for (size_t i = index; i < index + count; ++i)
+			m_a.e[i].freeMem();
+		relocate(m_a.e + index, m_a.e + index + count, m_a.size - index - count);
+		m_a.size -= static_cast<Size>(count);
+	}
+
+	void Value::setObject(size_t capacity)
+	{
+		freeMem();
+		m_o.m = nullptr;
+		m_o.size = 0;
+		m_type = VALUE_TYPE_OBJECT;
+		if (capacity > 0)
+			growObject(capacity);
+	}
+
+	size_t Value::getObjectCapacity() const
+	{
+		assert(m_type == VALUE_TYPE_OBJECT);
+		return m_flags & VALUE_FLAG_CAPACITY ? capacityOf(m_o.m) : m_o.size;
+	}
+
+	Value& Value::addMember(const char *key, size_t len, Value &&v)
+	{
+		assert(m_type == VALUE_TYPE_OBJECT && !(m_flags & VALUE_FLAG_ARENA));
+		assert(key != nullptr || len == 0);
+		/* key and v may belong to this object, whose members are about to move */
+		Value t(std::move(v));
+#ifdef AJ_COMPACT_VALUE
+		Value k;
+		k.setString(key, len);
+#else
+		char *k = static_cast<char *>(malloc(sizeof(char) * (len + 1)));
+		memcpy(k, key, len);
+		k[len] = '\0';
+		if (m_flags & VALUE_FLAG_BORROWED)
+			ownKeys();
+#endif
+		size_t capacity = getObjectCapacity();
+		if (m_o.size == capacity)
+			growObject(capacity = grown());
+		Member *m = m_o.m + m_o.size++;
+#ifdef AJ_COMPACT_VALUE
+		new (&m->kv) Value(std::move(k));
+#else
+		m->k = k;
+		m->klen = len;
+#endif
+		new (&m->v) Value(std::move(t));
+		/* an index already filled takes the new member, otherwise it is filled on the next lookup */
+		if (capacity >= AJ_OBJECT_INDEX_MIN) {
+			ObjectIndex *index = ObjectIndex::of(m_o.m, capacity);
+			if (index->state.load(std::memory_order_relaxed) == ObjectIndex::READY)
+				index->add(m_o.m, m_o.size - 1);
+		}
+		return m->v;
+	}
+
+	bool Value::removeMember(const char *key, size_t len)
+	{
+		assert(m_type == VALUE_TYPE_OBJECT && !(m_flags & VALUE_FLAG_ARENA));
+		Value *v = findMember(key, len);
+		if (v == nullptr)
+			return false;
+		size_t i = (reinterpret_cast<char *>(v) - reinterpret_cast<char *>(&m_o.m->v)) / sizeof(Member);
+		/* a parsed object's index sits after its size, which is about to change */
+		if (!(m_flags & VALUE_FLAG_CAPACITY))
+			growObject(m_o.size);
+		Member *m = m_o.m + i;
+		m->v.freeMem();
+#ifdef AJ_COMPACT_VALUE
+		m->kv.freeMem();
+#else
+		if (!(m_flags & VALUE_FLAG_BORROWED))
+			free(m->k);
+#endif
+		memmove(static_cast<void *>(m), m + 1, sizeof(Member) * (m_o.size - i - 1));
+		--m_o.size;
+		size_t capacity = getObjectCapacity();
+		if (capacity >= AJ_OBJECT_INDEX_MIN)
+			ObjectIndex::of(m_o.m, capacity)->state.store(ObjectIndex::EMPTY, std::memory_order_relaxed);
+		return true;
+	}
+
+	void Value::reserve(size_t capacity)
+	{
+		assert((m_type == VALUE_TYPE_ARRAY || m_type == VALUE_TYPE_OBJECT) && !(m_flags & VALUE_FLAG_ARENA));
+		if (m_type == VALUE_TYPE_ARRAY) {
+			if (capacity > getArrayCapacity())
+				growArray(capacity);
+		} else if (capacity > getObjectCapacity()) {
+			growObject(capacity);
+		}
+	}
+
+	/* the next capacity of a full container: half as much again, as the parse stack grows */
+	size_t Value::grown() const
+	{
+		size_t size = m_type == VALUE_TYPE_ARRAY ? m_a.size : m_o.size;
+		return size < 4 ? 4 : size + (size >> 1);
+	}
+
+	void Value::growArray(size_t capacity)
+	{
+		assert(capacity >= m_a.size && capacity <= static_cast<Size>(-1));
+		Value *e = static_cast<Value *>(allocWithCapacity(capacity, sizeof(Value) * capacity));
+		relocate(e, m_a.e, m_a.size);
+		freeElements(m_a.e, m_flags & VALUE_FLAG_CAPACITY);
+		m_a.e = e;
+		m_flags |= VALUE_FLAG_CAPACITY;
+	}
+
+	/* the index starts over empty, sized for the new capacity */
+	void Value::growObject(size_t capacity)
+	{
+		assert(capacity >= m_o.size && capacity <= static_cast<Size>(-1));
+		Member *m = static_cast<Member *>(allocWithCapacity(capacity, membersBytes(capacity)));
+		if (capacity >= AJ_OBJECT_INDEX_MIN)
+			ObjectIndex::of(m, capacity)->init(capacity);
+		if (m_o.size > 0)
+			memcpy(static_cast<void *>(m), m_o.m, sizeof(Member) * m_o.size);
+		freeElements(m_o.m, m_flags & VALUE_FLAG_CAPACITY);
+		m_o.m = m;
+		m_flags |= VALUE_FLAG_CAPACITY;
+	}
+
+#ifndef AJ_COMPACT_VALUE
+	/* before owned keys join borrowed ones, which the object could then not tell apart */
+	void Value::ownKeys()
+	{
+		for (size_t i = 0; i < m_o.size; ++i) {
+			Member &m = m_o.m[i];
+			char *k = static_cast<char *>(malloc(sizeof(char) * (m.klen + 1)));
+			memcpy(k, m.k, m.klen);
+			k[m.klen] = '\0';
+			m.k = k;
+		}
+		m_flags &= ~VALUE_FLAG_BORROWED;
+	}
+#endif
+
+	const char* Value::getObjectKey(size_t index) const
+	{
+		assert(m_type == VALUE_TYPE_OBJECT && index < m_o.size);
+		return (m_o.m + index)->key();
+	}
+
+	size_t Value::getObjectKeyLength(size_t index) const
+	{
+		assert(m_type == VALUE_TYPE_OBJECT && index < m_o.size);
+		return (m_o.m + index)->keyLength();
+	}
+
+	Value* Value::getObjectValue(size_t index)
+	{
+		assert(m_type == VALUE_TYPE_OBJECT && index < m_o.size);
+		return &((m_o.m + index)->v);
+	}
+
+	Value* Value::getObjectValue(size_t index) const
+	{
+		assert(m_type == VALUE_TYPE_OBJECT && index < m_o.size);
+		return &((m_o.m + index)->v);
+	}
+
+	Value* Value::findMember(const char *key, size_t len) const
+	{
+		assert(m_type == VALUE_TYPE_OBJECT);
+		assert(key != nullptr || len == 0);
+		if (m_o.size >= AJ_OBJECT_INDEX_MIN) {
+			ObjectIndex *index = ObjectIndex::of(m_o.m, getObjectCapacity());
+			if (index->state.load(std::memory_order_acquire) == ObjectIndex::READY || index->build(m_o.m, m_o.size)) {
+				const Member *found = index->find(m_o.m, key, len);
+				return found ? const_cast<Value *>(&found->v) : nullptr;
+			}
+		}
+		for (size_t i = 0; i < m_o.size; ++i)
+			if (m_o.m[i].keyLength() == len && (m_o.m[i].key() == key || memcmp(m_o.m[i].key(), key, len) == 0))
+				return &m_o.m[i].v;
+		return nullptr;
+	}
+
+	std::string Value::stringify() const
+	{
+		Context c;
+		c.stack = static_cast<char *>(malloc(c.size = AJ_PARSE_STRINGIFY_INIT_SIZE));
+
+		if (stringifyValue(c) != STRINGIFY_OK)
+			return std::string();
+
+		return std::string(c.stack, c.top);
+	}
+
+	/*
+	 * A newline followed by enough indentation for the deepest level so
+	 * far, so each line break is a single copy of its prefix.
+	 */
+	struct Value::Pretty {
+		const PrettyFormat &format;
+		const size_t newlineLength;
+		std::string breaks;
+		std::vector<const Member *> order;	/* sortKeys: the members of each open object, innermost last */
+
+		explicit Pretty(const PrettyFormat &f) : format(f), newlineLength(strlen(f.newline)), breaks(f.newline)
+		{
+			breaks.append(f.indent * 16, f.indentChar);
+		}
+		void lineBreak(Context &c, size_t depth)
+		{
+			size_t n = newlineLength + depth * format.indent;
+			if (n > breaks.size())
+				breaks.append(n * 2 - breaks.size(), format.indentChar);
+			PUTS(c, breaks.data(), n);
+		}
+		static bool keyLess(const Member *a, const Member *b)
+		{
+			size_t n = std::min(a->keyLength(), b->keyLength());
+			int r = memcmp(a->key(), b->key(), n);
+			return r != 0 ? r < 0 : a->keyLength() < b->keyLength();
+		}
+	};
+
+	std::string Value::stringify(const PrettyFormat &format) const
+	{
+		assert(format.newline != nullptr);
+		Context c;
+		c.stack = static_cast<char *>(malloc(c.size = AJ_PARSE_STRINGIFY_INIT_SIZE));
+		Pretty p(format);
+
+		if (stringifyPretty(c, p) != STRINGIFY_OK)
+			return std::string();
+
+		return std::string(c.stack, c.top);
+	}
+
+	StringifyResult Value::stringifyTo(OutputSink &sink, size_t bufferSize) const
+	{
+		return stringifyTo(sink, nullptr, bufferSize);
+	}
+
+	StringifyResult Value::stringifyTo(OutputSink &sink, const PrettyFormat &format, size_t bufferSize) const
+	{
+		return stringifyTo(sink, &format, bufferSize);
+	}
+
+	StringifyResult Value::stringifyTo(int fd) const
+	{
+		FdSink sink(fd);
+		return stringifyTo(sink);
+	}
+
+	StringifyResult Value::stringifyTo(FILE *f) const
+	{
+		FileSink sink(f);
+		return stringifyTo(sink);
+	}
+
+	/*
+	 * The stack doubles as the output buffer: containers hand it to the
+	 * sink between elements once it holds flushAt bytes, and long strings
+	 * go out a piece at a time, so it stays around twice that size.
+	 */
+	StringifyResult Value::stringifyTo(OutputSink &sink, const PrettyFormat *format, size_t bufferSize) const
+	{
+		assert(bufferSize > 0);
+		Context c;
+		c.stack = static_cast<char *>(malloc(c.size = bufferSize * 2 + AJ_PARSE_STRINGIFY_INIT_SIZE));
+		c.sink = &sink;
+		c.flushAt = bufferSize;
+
+		StringifyResult ret;
+		if (format != nullptr) {
+			assert(format->newline != nullptr);
+			Pretty p(*format);
+			ret = stringifyPretty(c, p);
+		} else {
+			ret = stringifyValue(c);
+		}
+		if (ret == STRINGIFY_OK && c.top > 0 && !sink.write(c.stack, c.top))
+			ret = STRINGIFY_WRITE_ERROR;
+		return ret;
+	}
+
+	/*
+	 * A whole value, containers included, without recursion: each open
+	 * container is a level holding its count so far (shifted left, the low
+	 * bit set for an object), apart from the stack the handler builds on.
+	 */
+	template <typename H>
+	ParseResult Value::parseValue(Context &c, H &h)
+	{
+		LevelStack<size_t> open;
+		ParseResult ret;
+		for (;;) {
+			if (c.json == c.end)
+				return PARSE_EXPECT_VALUE;
+			switch (*c.json) {
+			case 'n': ret = parseLiteral(c, h, "null"); break;
+			case 't': ret = parseLiteral(c, h, "true"); break;
+			case 'f': ret = parseLiteral(c, h, "false"); break;
+			case '\"': ret = parseString(c, h, false); break;
+			case '[':
+			case '{': {
+				const bool object = *c.json == '{';
+				if (open.size() >= c.maxDepth)
+					return PARSE_DEPTH_EXCEEDED;
+				++c.json;
+				if (!(object ? h.onStartObject() : h.onStartArray()))
+					return PARSE_ABORTED;
+				parseWhitespace(c);
+				if (peek(c.json, c.end) == (object ? '}' : ']')) {
+					++c.json;
+					ret = (object ? h.onEndObject(0) : h.onEndArray(0)) ? PARSE_OK : PARSE_ABORTED;
+					break;
+				}
+				open.push(object);
+				if (object && (ret = parseMemberKey(c, h)) != PARSE_OK)
+					return ret;
+				continue;
+			}
+			default:
+				if (*c.json == '-' || ISDIGIT(*c.json))
+					ret = parseNumber(c, h);
+				else
+					ret = PARSE_INVALID_VALUE;
+				break;
+			}
+			if (ret != PARSE_OK)
+				return ret;
+
+			/* a value is complete: close what it completes, up to a container wanting another */
+			for (;;) {
+				if (open.empty())
+					return PARSE_OK;
+				size_t &level = open.top();
+				level += 2;
+				const bool object = (level & 1) != 0;
+				parseWhitespace(c);
+				const char ch = peek(c.json, c.end);
+				if (ch == ',') {
+					++c.json;
+					parseWhitespace(c);
+					if (object && (ret = parseMemberKey(c, h)) != PARSE_OK)
+						return ret;
+					break;
+				}
+				if (ch != (object ? '}' : ']'))
+					return object ? PARSE_MISS_COMMA_OR_CURLY_BRACKET : PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+				++c.json;
+				const size_t count = open.pop() >> 1;
+				if (!(object ? h.onEndObject(count) : h.onEndArray(count)))
+					return PARSE_ABORTED;
+			}
+		}
+	}
+
+	/* ws = *(%x20 / %x09 / %x0A / %x0D) */
+	void Value::parseWhitespace(Context &c)
+	{
+		c.json = skipWhitespace(c.json, c.end, c.padded);
+	}
+
+	template <typename H>
+	ParseResult Value::parseLiteral(Context &c, H &h, const char* literal)
+	{
+		size_t n = strlen(literal);
+		if (static_cast<size_t>(c.end - c.json) < n || memcmp(c.json + 1, literal + 1, n - 1) != 0)
+			return PARSE_INVALID_VALUE;
+		c.json += n;
+		bool ok = literal[0] == 'n' ? h.onNull() : h.onBool(literal[0] == 't');
+		return ok ? PARSE_OK : PARSE_ABORTED;
+	}
+
+	/*
+	 * Validates and converts in one pass. Up to 19 significant digits are
+	 * accumulated into an integer; when that is at most 2^53 and the decimal
+	 * exponent is small enough for 10^e to be an exact double, one IEEE
+	 * multiplication or division gives the correctly rounded result (Clinger's
+	 * fast path). Everything else goes to strtod, fed the digits in
+	 * exponent-only form so the C locale's decimal point never matters.
+	 */
+	template <typename H>
+	ParseResult Value::parseNumber(Context &c, H &h)
+	{
+		static const double pow10[] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+		const uint64_t maxExact = uint64_t(1) << 53;
+		const char* p = c.json;
+		const char* end = c.end;
+		bool neg = false, truncated = false;
+		uint64_t m = 0;
+		int digits = 0;		/* significant digits in m */
+		long exp = 0;		/* value is m * 10^exp (+ truncated digits) */
+		long fracDigits = 0;
+
+		if (*p == '-') {
+			neg = true;
+			++p;
+		}
+		if (peek(p, end) == '0')
+			++p;
+		else {
+			if (!ISDIGIT1TO9(peek(p, end)))
+				return PARSE_INVALID_VALUE;
+			for (; ISDIGIT(peek(p, end)); ++p) {
+				unsigned digit = *p - '0';
+				if (digits < 19 || (digits == 19 && m <= (UINT64_MAX - digit) / 10)) {
+					/* a 20th digit is only kept while it fits, for UINT64 values */
+					m = m * 10 + digit;
+					++digits;
+				} else {
+					++exp;
+					truncated |= digit != 0;
+				}
+			}
+		}
+		if (exp == 0 && peek(p, end) != '.' && peek(p, end) != 'e' && peek(p, end) != 'E') {
+			/* an integer literal that fits is kept exact; "-0" stays a double to keep its sign */
+			if (!neg) {
+				c.json = p;
+				bool ok = m <= INT64_MAX ? h.onInt64(static_cast<int64_t>(m)) : h.onUint64(m);
+				return ok ? PARSE_OK : PARSE_ABORTED;
+			}
+			if (m != 0 && m <= uint64_t(INT64_MAX) + 1) {
+				c.json = p;
+				return h.onInt64(static_cast<int64_t>(0 - m)) ? PARSE_OK : PARSE_ABORTED;
+			}
+		}
+		if (peek(p, end) == '.') {
+			++p;
+			if (!ISDIGIT(peek(p, end)))
+				return PARSE_INVALID_VALUE;
+			for (; ISDIGIT(peek(p, end)); ++p, ++fracDigits) {
+				if (digits < 19) {
+					m = m * 10 + (*p - '0');
+					--exp;
+					if (m != 0)
+						++digits;
+				} else {
+					truncated |= *p != '0';
+				}
+			}
+		}
+		long e = 0;
+		if (peek(p, end) == 'e' || peek(p, end) == 'E') {
+			bool eneg = false;
+			++p;
+			if (peek(p, end) == '-' || peek(p, end) == '+')
+				eneg = *p++ == '-';
+			if (!ISDIGIT(peek(p, end)))
+				return PARSE_INVALID_VALUE;
+			for (; ISDIGIT(peek(p, end)); ++p)
+				if (e < 100000000)	/* far beyond any double, and no overflow */
+					e = e * 10 + (*p - '0');
+			if (eneg)
+				e = -e;
+		}
+		exp += e;
+
+		double d;
+		if (m == 0 && !truncated) {
+			d = 0.0;
+		} else if (!truncated && m <= maxExact && exp >= -22 && exp <= 22) {
+			d = exp < 0 ? m / pow10[-exp] : m * pow10[exp];
+		} else if (!truncated && m <= maxExact && exp > 22 && exp <= 22 + 15
+			&& m <= maxExact / static_cast<uint64_t>(pow10[exp - 22])) {
+			/* the extra powers fold exactly into the mantissa */
+			d = (m * static_cast<uint64_t>(pow10[exp - 22])) * 1e22;
+		} else {
+			/* hard case: strtod on "<all digits>e<exponent>" */
+			const char *s = c.json + neg;
+			size_t n = p - s;
+			char *num = static_cast<char *>(c.push(n + 24));
+			char *q = num;
+			for (; s != p && *s != 'e' && *s != 'E'; ++s)
+				if (*s != '.')
+					*q++ = *s;
+			q += sprintf(q, "e%ld", e - fracDigits);
+			errno = 0;
+			d = strtod(num, nullptr);
+			c.pop(n + 24);
+			if (errno == ERANGE && d == HUGE_VAL)
+				return PARSE_NUMBER_TOO_BIG;
+		}
+		c.json = p;
+		return h.onNumber(neg ? -d : d) ? PARSE_OK : PARSE_ABORTED;
+	}
+
+#define STRING_ERROR(ret, at)	\
+    do {					\
+        c.top = head;		\
+        c.json = at;		\
+        return ret;			\
+    } while (0)
+
+	ParseResult Value::parseStringRaw(Context &c, char *&str, size_t &len)
+	{
+		size_t head = c.top;
+		const char* p = ++c.json;
+		for (;;) {
+			const char *q = scanString(p, c.end, c.padded);
+			if (q != p) {
+				PUTS(c, p, q - p);
+				p = q;
+			}
+			if (p == c.end)
+				STRING_ERROR(PARSE_MISS_QUOTATION_MARK, p);
+			char ch = *p++;
+			switch (ch) {
+			case '\"':
+				len = c.top - head;
+				str = (char *)c.pop(len);
+				c.json = p;
+				return PARSE_OK;
+			case '\\':
+				ch = peek(p++, c.end);
+				switch (ch) {
+				case '"': PUTC(c, '\"'); break;
+				case '\\': PUTC(c, '\\'); break;
+				case 'b': PUTC(c, '\b'); break;
+				case 'f': PUTC(c, '\f'); break;
+				case 'r': PUTC(c, '\r'); break;
+				case 't': PUTC(c, '\t'); break;
+				case 'n': PUTC(c, '\n'); break;
+				case '/': PUTC(c, '/'); break;
+				case 'u': {
+					unsigned u;
+					const char *escape = p - 2;
+					ParseResult ret = parseEscapedUnicode(p, c.end, u);
+					if (ret != PARSE_OK)
+						STRING_ERROR(ret, escape);
+					encode_utf8(c, u);
+					break;
+				}
+				default: STRING_ERROR(PARSE_INVALID_STRING_ESCAPE, p - 2);
+				}
+				break;
+			default:
+				/* scanString only stops early at '"', '\\' and control characters */
+				STRING_ERROR(PARSE_INVALID_STRING_CHAR, p - 1);
+			}
+		}
+	}
+
+	/* unescapes in place: the result never outgrows the source, so it can overwrite it */
+	ParseResult Value::parseStringInsitu(Context &c, char *&str, size_t &len)
+	{
+		char *p = const_cast<char *>(++c.json);
+		char *d = p;
+		str = p;
+		for (;;) {
+			char *q = const_cast<char *>(scanString(p, c.end, c.padded));
+			if (q != p) {
+				if (d != p)
+					memmove(d, p, q - p);
+				d += q - p;
+				p = q;
+			}
+			if (p == c.end) {
+				c.json = p;
+				return PARSE_MISS_QUOTATION_MARK;
+			}
+			char ch = *p++;
+			switch (ch) {
+			case '\"':
+				*d = '\0';
+				len = d - str;
+				c.json = p;
+				return PARSE_OK;
+			case '\\':
+				ch = peek(p++, c.end);
+				switch (ch) {
+				case '"': *d++ = '\"'; break;
+				case '\\': *d++ = '\\'; break;
+				case 'b': *d++ = '\b'; break;
+				case 'f': *d++ = '\f'; break;
+				case 'r': *d++ = '\r'; break;
+				case 't': *d++ = '\t'; break;
+				case 'n': *d++ = '\n'; break;
+				case '/': *d++ = '/'; break;
+				case 'u': {
+					unsigned u;
+					const char *e = p;
+					ParseResult ret = parseEscapedUnicode(e, c.end, u);
+					if (ret != PARSE_OK) {
+						c.json = p - 2;
+						return ret;
+					}
+					p = const_cast<char *>(e);
+					d = encode_utf8(d, u);
+					break;
+				}
+				default:
+					c.json = p - 2;
+					return PARSE_INVALID_STRING_ESCAPE;
+				}
+				break;
+			default:
+				c.json = p - 1;
+				return PARSE_INVALID_STRING_CHAR;
+			}
+		}
+	}
+
+	/* a raw string is scratch just above the stack top, valid until the next push */
+	template <typename H>
+	ParseResult Value::parseString(Context &c, H &h, bool key)
+	{
+		char *s;
+		size_t len;
+		ParseResult ret = c.insitu ? parseStringInsitu(c, s, len) : parseStringRaw(c, s, len);
+		if (ret != PARSE_OK)
+			return ret;
+		return (key ? h.onKey(s, len) : h.onString(s, len)) ? PARSE_OK : PARSE_ABORTED;
+	}
+
+	/* "key" ws ':' ws, in front of each member's value */
+	template <typename H>
+	ParseResult Value::parseMemberKey(Context &c, H &h)
+	{
+		if (peek(c.json, c.end) != '\"')
+			return PARSE_MISS_KEY;
+		ParseResult ret = parseString(c, h, true);
+		if (ret != PARSE_OK)
+			return ret == PARSE_ABORTED ? ret : PARSE_MISS_KEY;
+		parseWhitespace(c);
+		if (peek(c.json, c.end) != ':')
+			return PARSE_MISS_COLON;
+		++c.json;
+		parseWhitespace(c);
+		return PARSE_OK;
+	}
+
+	static void putDouble(Context &c, double d)
+	{
+		char *p = static_cast<char *>(c.push(32));
+		if (std::isfinite(d))
+			c.top -= 32 - (writeDouble(p, d) - p);
+		else
+			c.top -= 32 - sprintf(p, "%.17g", d);
+	}
+
+	static void putInt64(Context &c, int64_t i)
+	{
+		char *p = static_cast<char *>(c.push(21));
+		char *q = p;
+		if (i < 0)
+			*q++ = '-';
+		q = writeUint64(q, i < 0 ? 0 - static_cast<uint64_t>(i) : i);
+		c.top -= 21 - (q - p);
+	}
+
+	static void putUint64(Context &c, uint64_t u)
+	{
+		char *p = static_cast<char *>(c.push(20));
+		c.top -= 20 - (writeUint64(p, u) - p);
+	}
+
+	/* stringifyTo: hands a full stack to the sink and starts it over */
+	static inline bool drained(Context &c)
+	{
+		if (c.sink == nullptr || c.top < c.flushAt)
+			return true;
+		bool ok = c.sink->write(c.stack, c.top);
+		c.top = 0;
+		return ok;
+	}
+
+	/* containers are walked with a level each instead of recursion */
+	StringifyResult Value::stringifyValue(Context &c) const
+	{
+		struct Level { const Value *v; size_t i; };
+		LevelStack<Level> open;
+		const Value *v = this;
+		StringifyResult ret;
+		for (;;) {
+			switch (v->m_type) {
+			case VALUE_TYPE_NULL:PUTS(c, "null", 4); break;
+			case VALUE_TYPE_FALSE:PUTS(c, "false", 5); break;
+			case VALUE_TYPE_TRUE:PUTS(c, "true", 4); break;
+			case VALUE_TYPE_NUMBER: putDouble(c, v->m_n); break;
+			case VALUE_TYPE_INT64: putInt64(c, v->m_i); break;
+			case VALUE_TYPE_UINT64: putUint64(c, v->m_u); break;
+			case VALUE_TYPE_STRING:
+				if ((ret = stringifyString(c, v->getString(), v->getStringLength())) != STRINGIFY_OK)
+					return ret;
+				break;
+			case VALUE_TYPE_ARRAY:
+				PUTC(c, '[');
+				open.push(Level{ v, 0 });
+				break;
+			case VALUE_TYPE_OBJECT:
+				PUTC(c, '{');
+				open.push(Level{ v, 0 });
+				break;
+			}
+
+			/* on to the next element or member, closing the containers that have none left */
+			for (;;) {
+				if (open.empty())
+					return STRINGIFY_OK;
+				Level &l = open.top();
+				if (l.i > 0 && !drained(c))
+					return STRINGIFY_WRITE_ERROR;
+				if (l.v->m_type == VALUE_TYPE_ARRAY) {
+					if (l.i == l.v->m_a.size) {
+						PUTC(c, ']');
+						open.pop();
+						continue;
+					}
+					if (l.i > 0) PUTC(c, ',');
+					v = l.v->m_a.e + l.i++;
+				} else {
+					if (l.i == l.v->m_o.size) {
+						PUTC(c, '}');
+						open.pop();
+						continue;
+					}
+					if (l.i > 0) PUTC(c, ',');
+					const Member &m = l.v->m_o.m[l.i++];
+					if ((ret = stringifyString(c, m.key(), m.keyLength())) != STRINGIFY_OK)
+						return ret;
+					PUTC(c, ':');
+					v = &m.v;
+				}
+				break;
+			}
+		}
+	}
+
+	/* the letter after '\\' for the bytes scanString stops at, 'u' for \u00XX */
+	static const char s_escape[0x60] = {
+		'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+		'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+		0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0
+	};
+
+	/* containers broken over lines, anything else as stringifyValue() writes it */
+	StringifyResult Value::stringifyPretty(Context &c, Pretty &p) const
+	{
+		/* first: where this object's members start in p.order when sorted */
+		struct Level { const Value *v; size_t i, n, first; };
+		LevelStack<Level> open;
+		const Value *v = this;
+		StringifyResult ret;
+		for (;;) {
+			const bool object = v->m_type == VALUE_TYPE_OBJECT;
+			if (v->m_type != VALUE_TYPE_ARRAY && !object) {
+				if ((ret = v->stringifyValue(c)) != STRINGIFY_OK)
+					return ret;
+			} else if ((object ? v->m_o.size : v->m_a.size) == 0) {
+				PUTS(c, object ? "{}" : "[]", 2);
+			} else {
+				Level l = { v, 0, object ? v->m_o.size : v->m_a.size, p.order.size() };
+				if (object && p.format.sortKeys) {
+					for (size_t i = 0; i < l.n; i++)
+						p.order.push_back(v->m_o.m + i);
+					std::stable_sort(p.order.begin() + l.first, p.order.end(), Pretty::keyLess);
+				}
+				PUTC(c, object ? '{' : '[');
+				open.push(l);
+			}
+
+			/* on to the next element or member, closing the containers that have none left */
+			for (;;) {
+				if (open.empty())
+					return STRINGIFY_OK;
+				Level &l = open.top();
+				if (l.i > 0 && !drained(c))
+					return STRINGIFY_WRITE_ERROR;
+				const bool inObject = l.v->m_type == VALUE_TYPE_OBJECT;
+				if (l.i == l.n) {
+					p.order.resize(l.first);
+					open.pop();
+					p.lineBreak(c, open.size());
+					PUTC(c, inObject ? '}' : ']');
+					continue;
+				}
+				if (l.i > 0) PUTC(c, ',');
+				p.lineBreak(c, open.size());
+				if (inObject) {
+					const Member &m = p.format.sortKeys ? *p.order[l.first + l.i] : l.v->m_o.m[l.i];
+					if ((ret = stringifyString(c, m.key(), m.keyLength())) != STRINGIFY_OK)
+						return ret;
+					PUTS(c, ": ", 2);
+					v = &m.v;
+				} else {
+					v = l.v->m_a.e + l.i;
+				}
+				++l.i;
+				break;
+			}
+		}
+	}
+
+	/*
+	 * Runs that need no escaping are found with the string scanners and
+	 * copied whole; q must have room for the worst case, six bytes for
+	 * each one in [p, end).
+	 */
+	char* Value::escape(char *q, const char *p, const char *end)
+	{
+		for (;;) {
+			const char *run = scanString(p, end, false);
+			memcpy(q, p, run - p);
+			q += run - p;
+			if (run == end)
+				return q;
+			unsigned char ch = static_cast<unsigned char>(*run);
+			*q++ = '\\';
+			*q++ = s_escape[ch];
+			if (s_escape[ch] == 'u') {
+				*q++ = '0';
+				*q++ = '0';
+				*q++ = s_table[ch >> 4];
+				*q++ = s_table[ch & 0xf];
+			}
+			p = run + 1;
+		}
+	}
+
+	/* bytes escaped at a time once a string is too long to reserve its worst case for */
+	static const size_t STRING_PIECE = 4096;
+
+	/* room is reserved once for the worst case, and what is left over given back */
+	StringifyResult Value::stringifyString(Context &c, const char *s, size_t len)
+	{
+		assert(s != nullptr);
+		if (c.sink != nullptr ? len > c.flushAt / 6 : len > STRING_PIECE)
+			return stringifyLongString(c, s, len);
+		const size_t reserve = len * 6 + 2;
+		char *q = static_cast<char *>(c.push(reserve)), *start = q;
+		*q++ = '"';
+		q = escape(q, s, s + len);
+		*q++ = '"';
+		c.top -= reserve - (q - start);
+		return STRINGIFY_OK;
+	}
+
+	/*
+	 * A string too long for the stringifyTo buffer, or to reserve six
+	 * times its length for: escaped a piece at a time with the stack
+	 * drained in between. Runs that need no escaping and fill a piece by
+	 * themselves are copied with room for just them, or with a sink and
+	 * a whole buffer's worth, written straight from s.
+	 */
+	StringifyResult Value::stringifyLongString(Context &c, const char *s, size_t len)
+	{
+		const size_t piece = c.sink != nullptr ? c.flushAt / 6 + 1 : STRING_PIECE;
+		const char *p = s, *end = s + len;
+		PUTC(c, '"');
+		while (p != end) {
+			if (!drained(c))
+				return STRINGIFY_WRITE_ERROR;
+			const char *run = scanString(p, end, false);
+			if (c.sink == nullptr && static_cast<size_t>(run - p) >= piece) {
+				PUTS(c, p, run - p);
+				p = run;
+				continue;
+			}
+			if (c.sink != nullptr && static_cast<size_t>(run - p) >= c.flushAt) {
+				bool ok = c.sink->writev(c.stack, c.top, p, run - p);
+				c.top = 0;
+				if (!ok)
+					return STRINGIFY_WRITE_ERROR;
+				p = run;
+				continue;
+			}
+			const char *stop = static_cast<size_t>(end - p) > piece ? p + piece : end;
+			char *q = static_cast<char *>(c.push(piece * 6)), *start = q;
+			q = escape(q, p, stop);
+			c.top -= piece * 6 - (q - start);
+			p = stop;
+		}
+		PUTC(c, '"');
+		return STRINGIFY_OK;
+	}
+
+	void Value::freeMem()
+	{
+		/* arena-backed values are released all at once by their Document */
+		if (m_flags & VALUE_FLAG_ARENA) {
+			m_type = VALUE_TYPE_NULL;
+			m_flags = 0;
+			return;
+		}
+
+		switch (m_type) {
+		case VALUE_TYPE_STRING:
+			if (!(m_flags & (VALUE_FLAG_BORROWED | VALUE_FLAG_INLINE)))
+				free(m_s.s);
+			break;
+		case VALUE_TYPE_ARRAY:
+		case VALUE_TYPE_OBJECT: {
+			/* a level per nested container; other children are freed as they are passed */
+			struct Level { Value *v; size_t i; };
+			LevelStack<Level> open;
+			open.push(Level{ this, 0 });
+			while (!open.empty()) {
+				Level &l = open.top();
+				Value *v = l.v, *child;
+				if (v->m_type == VALUE_TYPE_ARRAY) {
+					if (l.i == v->m_a.size) {
+						freeElements(v->m_a.e, v->m_flags & VALUE_FLAG_CAPACITY);
+						open.pop();
+						continue;
+					}
+					child = v->m_a.e + l.i++;
+				} else {
+					if (l.i == v->m_o.size) {
+						freeElements(v->m_o.m, v->m_flags & VALUE_FLAG_CAPACITY);
+						open.pop();
+						continue;
+					}
+					Member *m = v->m_o.m + l.i++;
+#ifdef AJ_COMPACT_VALUE
+					m->kv.freeMem();
+#else
+					if (!(v->m_flags & VALUE_FLAG_BORROWED))
+						free(m->k);
+#endif
+					child = &m->v;
+				}
+				if ((child->m_type == VALUE_TYPE_ARRAY || child->m_type == VALUE_TYPE_OBJECT) && !(child->m_flags & VALUE_FLAG_ARENA))
+					open.push(Level{ child, 0 });
+				else
+					child->freeMem();
+			}
+			break;
+		}
+		default:
+			break;
+		}
+
+		m_type = VALUE_TYPE_NULL;
+		m_flags = 0;
+	}
+
+	void* Context::push(size_t n)
+	{
+		assert(n > 0);
+		if (top + n >= size) {
+			if (size == 0)
+				size = AJ_PARSE_STACK_INIT_SIZE;
+			/* at least a byte a step: a Parser may have left size at 1 */
+			while (top + n > size)
+				size += std::max<size_t>(size >> 1, 1);
+			stack = (char *)realloc(stack, size);
+			++grows;
+		}
+		void* res = stack + top;
+		if ((top += n) > peak)
+			peak = top;
+		return res;
+	}
+
+	void* Context::pop(size_t n)
+	{
+		assert(top >= n);
+		return stack + (top -= n);
+	}
+
+	bool Value::parseHex4(const char*& p, unsigned& u)
+	{
+		u = 0;
+		for (auto i = 0; i < 4; ++i) {
+			u <<= 4;
+			char ch = *p++;
+			if (ch >= '0' && ch <= '9')
+				u += ch - '0';
+			else if (ch >= 'a' && ch <= 'f')
+				u += ch - 'a' + 10;
+			else if (ch >= 'A' && ch <= 'F')
+				u += ch - 'A' + 10;
+			else
+				return false;
+		}
+		return true;
+	}
+
+	/* p points just past "\\u"; a high surrogate must be followed by an escaped low one */
+	ParseResult Value::parseEscapedUnicode(const char *&p, const char *end, unsigned &u)
+	{
+		if (end - p < 4 || !parseHex4(p, u))
+			return PARSE_INVALID_UNICODE_HEX;
+		if (u >= 0xd800 && u <= 0xdbff) {
+			unsigned ul;
+			if (end - p >= 6 && p[0] == '\\' && p[1] == 'u' && parseHex4(p += 2, ul) && ul >= 0xdc00 && ul <= 0xdfff)
+				u = 0x10000 + ((u - 0xd800) << 10) + (ul - 0xdc00);
+			else
+				return PARSE_INVALID_UNICODE_SURROGATE;
+		}
+		return PARSE_OK;
+	}
+
+	char* Value::encode_utf8(char *p, unsigned u)
+	{
+		if (u < 0x80) {
+			*p++ = 0x7f & u;
+		} else if (u < 0x800) {
+			*p++ = 0xc0 | ((u >> 6) & 0x1f);
+			*p++ = 0x80 | (u & 0x3f);
+		} else if (u < 0x10000) {
+			*p++ = 0xe0 | ((u >> 12) & 0x0f);
+			*p++ = 0x80 | ((u >> 6) & 0x3f);
+			*p++ = 0x80 | (u & 0x3f);
+		} else {
+			*p++ = 0xf0 | ((u >> 18) & 0x07);
+			*p++ = 0x80 | ((u >> 12) & 0x3f);
+			*p++ = 0x80 | ((u >> 6) & 0x3f);
+			*p++ = 0x80 | (u & 0x3f);
+		}
+		return p;
+	}
+
+	void Value::encode_utf8(Context &c, unsigned u)
+	{
+		char *p = static_cast<char *>(c.push(4));
+		c.top -= 4 - (encode_utf8(p, u) - p);
+	}
+
+	Parser::Parser(size_t reserve, size_t maxRetained)
+		: m_maxRetained(maxRetained)
+	{
+		if (reserve > 0)
+			m_c.stack = static_cast<char *>(malloc(m_c.size = reserve));
+	}
+
+	ParseResult Parser::parse(Value &v, const char *json, size_t len, unsigned flags)
+	{
+		size_t grows = m_c.grows;
+		m_c.padded = (flags & PARSE_FLAG_PADDED) != 0;
+		ParseResult res = v.parse(m_c, json, len);
+		return record(res, grows);
+	}
+
+	ParseResult Parser::parse(Document &d, const char *json, size_t len, unsigned flags)
+	{
+		size_t grows = m_c.grows;
+		m_c.padded = (flags & PARSE_FLAG_PADDED) != 0;
+		ParseResult res = d.parse(m_c, json, len);
+		return record(res, grows);
+	}
+
+	ParseResult Parser::parseInsitu(Value &v, char *json, size_t len, unsigned flags)
+	{
+		size_t grows = m_c.grows;
+		m_c.insitu = true;
+		m_c.padded = (flags & PARSE_FLAG_PADDED) != 0;
+		ParseResult res = v.parse(m_c, json, len);
+		m_c.insitu = false;
+		return record(res, grows);
+	}
+
+	ParseResult Parser::parseInsitu(Document &d, char *json, size_t len, unsigned flags)
+	{
+		size_t grows = m_c.grows;
+		m_c.insitu = true;
+		m_c.padded = (flags & PARSE_FLAG_PADDED) != 0;
+		ParseResult res = d.parse(m_c, json, len);
+		m_c.insitu = false;
+		return record(res, grows);
+	}
+
+	ParseResult Parser::parse(Handler &h, const char *json, size_t len, unsigned flags)
+	{
+		size_t grows = m_c.grows;
+		m_c.padded = (flags & PARSE_FLAG_PADDED) != 0;
+		ParseResult res = Value::parseDocument(m_c, h, json, len);
+		m_c.top = 0;
+		return record(res, grows);
+	}
+
+	ParseResult Parser::parseInsitu(Handler &h, char *json, size_t len, unsigned flags)
+	{
+		size_t grows = m_c.grows;
+		m_c.insitu = true;
+		m_c.padded = (flags & PARSE_FLAG_PADDED) != 0;
+		ParseResult res = Value::parseDocument(m_c, h, json, len);
+		m_c.insitu = false;
+		m_c.top = 0;
+		return record(res, grows);
+	}
+
+	ParseResult Parser::record(ParseResult res, size_t grows)
+	{
+		size_t cold = coldGrows(m_c.peak);
+
+		grows = m_c.grows - grows;
+		++m_stats.documents;
+		m_stats.reallocs += grows;
+		if (cold > grows)
+			m_stats.reallocsAvoided += cold - grows;
+		if (m_c.peak > m_stats.highWater)
+			m_stats.highWater = m_c.peak;
+		if (m_c.size > m_maxRetained) {
+			/* shrink back so one huge document does not pin its stack forever */
+			if (m_maxRetained == 0) {
+				release();
+			} else {
+				m_c.stack = static_cast<char *>(realloc(m_c.stack, m_c.size = m_maxRetained));
+			}
+			++m_stats.shrinks;
+		}
+		return res;
+	}
+
+	void Parser::release()
+	{
+		free(m_c.stack);
+		m_c.stack = nullptr;
+		m_c.size = m_c.top = 0;
+	}
+
+	/* number of reallocs a fresh Context needs to reach `peak` bytes, see Context::push() */
+	size_t Parser::coldGrows(size_t peak)
+	{
+		if (peak == 0)
+			return 0;
+		size_t grows = 1;
+		for (size_t size = AJ_PARSE_STACK_INIT_SIZE; size <= peak; size += std::max<size_t>(size >> 1, 1))
+			++grows;
+		return grows;
+	}
+
+	ParseResult PushParser::feed(const char *s, size_t len)
+	{
+		assert(s != nullptr || len == 0);
+		const char *p = s, *end = s + len;
+		const bool fresh = m_result == PARSE_OK;	/* an error from here on is a new one */
+		bool inToken = false;	/* p is past the token an error is in */
+		while (m_result == PARSE_OK && p != end) {
+			if (m_state >= STATE_STRING) {
+				if (m_token.empty())
+					m_tokenAt = m_fed + (p - s);
+				p = token(p, end);
+				inToken = m_result != PARSE_OK;
+				continue;
+			}
+			if ((p = skipWhitespace(p, end, false)) == end)
+				break;
+			switch (m_state) {
+			case STATE_VALUE:
+				p = value(p);
+				break;
+			case STATE_ARRAY_FIRST:
+				p = *p == ']' ? close(p) : value(p);
+				break;
+			case STATE_OBJECT_FIRST:
+				if (*p == '}') {
+					p = close(p);
+					break;
+				}
+				/* fall through */
+			case STATE_KEY:
+				if (*p != '\"') {
+					m_result = PARSE_MISS_KEY;
+					break;
+				}
+				m_state = STATE_KEY_STRING;
+				m_escape = false;
+				break;
+			case STATE_COLON:
+				if (*p != ':') {
+					m_result = PARSE_MISS_COLON;
+					break;
+				}
+				++p;
+				m_state = STATE_VALUE;
+				break;
+			case STATE_AFTER_VALUE:
+				if (*p == ',') {
+					++p;
+					m_state = top().kind == '[' ? STATE_VALUE : STATE_KEY;
+				} else if (*p == (top().kind == '[' ? ']' : '}')) {
+					p = close(p);
+				} else {
+					m_result = afterValueError();
+				}
+				break;
+			default:
+				m_result = PARSE_ROOT_NOT_SINGULAR;
+				break;
+			}
+		}
+		if (fresh && m_result != PARSE_OK)
+			ParseError::fail(m_result, nullptr, 0, inToken ? m_errorAt : m_fed + (p - s));
+		m_fed += len;
+		return m_result;
+	}
+
+	ParseResult PushParser::finish()
+	{
+		const bool fresh = m_result == PARSE_OK;
+		size_t at = m_fed;
+		if (m_result == PARSE_OK && m_state >= STATE_STRING) {
+			/* what is left is all there is: let the grammar report how it ends */
+			complete(m_token.data(), m_token.data() + m_token.size());
+			at = m_errorAt;
+		}
+		ParseResult res = m_result;
+		if (res == PARSE_OK) {
+			switch (m_state) {
+			case STATE_DONE: break;
+			case STATE_VALUE:
+			case STATE_ARRAY_FIRST: res = PARSE_EXPECT_VALUE; break;
+			case STATE_OBJECT_FIRST:
+			case STATE_KEY: res = PARSE_MISS_KEY; break;
+			case STATE_COLON: res = PARSE_MISS_COLON; break;
+			default: res = afterValueError(); break;
+			}
+		}
+		if (fresh && res != PARSE_OK)
+			ParseError::fail(res, nullptr, 0, at);
+		reset();
+		return res;
+	}
+
+	void PushParser::reset()
+	{
+		m_c.top = 0;
+		m_token.clear();
+		m_state = STATE_VALUE;
+		m_escape = false;
+		m_depth = 0;
+		m_fed = 0;
+		m_result = PARSE_OK;
+	}
+
+	/* the first byte of a value: containers open here, tokens only start */
+	const char* PushParser::value(const char *p)
+	{
+		switch (*p) {
+		case '[':
+		case '{': {
+			if (m_depth >= m_c.maxDepth) {
+				m_result = PARSE_DEPTH_EXCEEDED;
+				return p;
+			}
+			if (!(*p == '[' ? m_h.onStartArray() : m_h.onStartObject())) {
+				m_result = PARSE_ABORTED;
+				return p;
+			}
+			Level *l = static_cast<Level *>(m_c.push(sizeof(Level)));
+			l->count = 0;
+			l->kind = *p;
+			++m_depth;
+			m_state = *p == '[' ? STATE_ARRAY_FIRST : STATE_OBJECT_FIRST;
+			return p + 1;
+		}
+		case '\"':
+			m_state = STATE_STRING;
+			m_escape = false;
+			return p;
+		case 'n':
+		case 't':
+		case 'f':
+			m_state = STATE_LITERAL;
+			return p;
+		default:
+			if (*p == '-' || ISDIGIT(*p))
+				m_state = STATE_NUMBER;
+			else
+				m_result = PARSE_INVALID_VALUE;
+			return p;
+		}
+	}
+
+	/*
+	 * Finds where the current token ends. A token that ends in this chunk and
+	 * started in it is parsed straight from the chunk; otherwise its bytes are
+	 * collected in m_token first.
+	 */
+	const char* PushParser::token(const char *p, const char *end)
+	{
+		const char *q = p;
+		switch (m_state) {
+		case STATE_STRING:
+		case STATE_KEY_STRING:
+			if (m_token.empty())
+				++q;	/* the opening quote */
+			while (q != end) {
+				if (m_escape) {
+					m_escape = false;
+					++q;
+					continue;
+				}
+				if ((q = scanString(q, end, false)) == end)
+					break;
+				if (*q == '\"')
+					break;
+				/* a control character is left for the grammar to reject */
+				m_escape = *q++ == '\\';
+			}
+			if (q != end)
+				++q;
+			else
+				q = nullptr;
+			break;
+		case STATE_NUMBER:
+			while (q != end && (ISDIGIT(*q) || *q == '-' || *q == '+' || *q == '.' || *q == 'e' || *q == 'E'))
+				++q;
+			if (q == end)
+				q = nullptr;
+			break;
+		default:
+			while (q != end && *q >= 'a' && *q <= 'z')
+				++q;
+			if (q == end)
+				q = nullptr;
+			break;
+		}
+
+		if (q == nullptr) {
+			m_token.append(p, end - p);
+			return end;
+		}
+		if (m_token.empty()) {
+			complete(p, q);
+		} else {
+			m_token.append(p, q - p);
+			complete(m_token.data(), m_token.data() + m_token.size());
+			m_token.clear();
+		}
+		return q;
+	}
+
+	/* [b, e) is one whole token, or all of an unterminated one at finish() */
+	void PushParser::complete(const char *b, const char *e)
+	{
+		m_c.json = b;
+		m_c.end = e;
+		if (m_state == STATE_KEY_STRING) {
+			ParseResult ret = Value::parseString(m_c, m_h, true);
+			if (ret != PARSE_OK)
+				m_result = ret == PARSE_ABORTED ? ret : PARSE_MISS_KEY;
+			m_state = STATE_COLON;
+		} else if ((m_result = Value::parseValue(m_c, m_h)) == PARSE_OK) {
+			endValue();
+			if (m_c.json != e) {
+				/* "01", "1.2.3", "nullx": the grammar stopped early, as the tree parser would */
+				m_result = afterValueError();
+			}
+		}
+		/* the grammar leaves m_c.json at the byte it rejected, or where it stopped */
+		m_errorAt = m_tokenAt + (m_c.json - b);
+	}
+
+	const char* PushParser::close(const char *p)
+	{
+		Level l = top();
+		m_c.pop(sizeof(Level));
+		--m_depth;
+		if (!(l.kind == '[' ? m_h.onEndArray(l.count) : m_h.onEndObject(l.count))) {
+			m_result = PARSE_ABORTED;
+			return p;
+		}
+		endValue();
+		return p + 1;
+	}
+
+	void PushParser::endValue()
+	{
+		if (m_depth == 0) {
+			m_state = STATE_DONE;
+		} else {
+			++top().count;
+			m_state = STATE_AFTER_VALUE;
+		}
+	}
+
+	ParseResult PushParser::afterValueError()
+	{
+		if (m_depth == 0)
+			return PARSE_ROOT_NOT_SINGULAR;
+		return top().kind == '[' ? PARSE_MISS_COMMA_OR_SQUARE_BRACKET : PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+	}
+
+	bool MappedFile::open(const char *path, bool writable)
+	{
+		close();
+#ifndef AJ_NO_MMAP
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		int err = fstat(fd, &st) != 0 ? errno : S_ISREG(st.st_mode) ? 0 : EINVAL;
+		if (err != 0) {
+			::close(fd);
+			errno = err;
+			return false;
+		}
+		if (st.st_size > 0) {
+			void *p = mmap(nullptr, st.st_size, PROT_READ | (writable ? PROT_WRITE : 0), MAP_PRIVATE, fd, 0);
+			if (p == MAP_FAILED) {
+				err = errno;
+				::close(fd);
+				errno = err;
+				return false;
+			}
+			madvise(p, st.st_size, MADV_SEQUENTIAL);
+			m_data = static_cast<char *>(p);
+			m_size = m_mapped = static_cast<size_t>(st.st_size);
+			/* the rest of the last page is readable and reads as zeros */
+			size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+			m_padded = m_size % page != 0 && page - m_size % page >= AJ_PARSE_PADDING;
+		}
+		::close(fd);
+		return true;
+#else
+		(void)writable;
+		FILE *f = fopen(path, "rb");
+		if (f == nullptr)
+			return false;
+		long size = fseek(f, 0, SEEK_END) == 0 ? ftell(f) : -1;
+		if (size < 0 || fseek(f, 0, SEEK_SET) != 0) {
+			fclose(f);
+			return false;
+		}
+		m_data = static_cast<char *>(malloc(size + AJ_PARSE_PADDING));
+		m_size = fread(m_data, 1, size, f);
+		memset(m_data + m_size, 0, AJ_PARSE_PADDING);
+		m_padded = true;
+		bool ok = !ferror(f);
+		fclose(f);
+		if (!ok)
+			close();
+		return ok;
+#endif
+	}
+
+	void MappedFile::close()
+	{
+#ifndef AJ_NO_MMAP
+		if (m_mapped > 0)
+			munmap(m_data, m_mapped);
+#else
+		free(m_data);
+#endif
+		m_data = nullptr;
+		m_size = m_mapped = 0;
+		m_padded = false;
+	}
+
+	void MappedFile::swap(MappedFile &other)
+	{
+		std::swap(m_data, other.m_data);
+		std::swap(m_size, other.m_size);
+		std::swap(m_mapped, other.m_mapped);
+		std::swap(m_padded, other.m_padded);
+	}
+
+	Arena::Arena(size_t chunkSize) : m_chunkSize(chunkSize)
+	{
+		assert(chunkSize > sizeof(Chunk));
+	}
+
+	void* Arena::alloc(size_t n)
+	{
+		n = (n + 7) & ~size_t(7);
+		if (m_head && m_head->used + n <= m_head->size) {
+			void *res = reinterpret_cast<char *>(m_head) + m_head->used;
+			m_head->used += n;
+			m_used += n;
+			return res;
+		}
+
+		size_t size = n + sizeof(Chunk) > m_chunkSize ? n + sizeof(Chunk) : m_chunkSize;
+		Chunk *chunk = static_cast<Chunk *>(malloc(size));
+		chunk->size = size;
+		chunk->used = sizeof(Chunk) + n;
+		if (m_head && size > m_chunkSize) {
+			/* an oversized block gets its own chunk, keep filling the current one */
+			chunk->next = m_head->next;
+			m_head->next = chunk;
+		} else {
+			chunk->next = m_head;
+			m_head = chunk;
+		}
+		m_capacity += size;
+		m_used += n;
+		return reinterpret_cast<char *>(chunk) + sizeof(Chunk);
+	}
+
+	void Arena::clear()
+	{
+		/* keep one regular chunk around for the next document */
+		Chunk *keep = nullptr;
+		while (m_head) {
+			Chunk *next = m_head->next;
+			if (keep == nullptr && m_head->size == m_chunkSize)
+				keep = m_head;
+			else
+				free(m_head);
+			m_head = next;
+		}
+		m_used = 0;
+		m_capacity = 0;
+		if ((m_head = keep) != nullptr) {
+			keep->next = nullptr;
+			keep->used = sizeof(Chunk);
+			m_capacity = keep->size;
+		}
+	}
+
+	void Arena::release()
+	{
+		clear();
+		free(m_head);
+		m_head = nullptr;
+		m_capacity = 0;
+	}
+
+	size_t Arena::chunks() const
+	{
+		size_t n = 0;
+		for (Chunk *p = m_head; p; p = p->next)
+			++n;
+		return n;
+	}
+
+	const char* KeyTable::intern(const char *key, size_t len)
+	{
+		++m_stats.lookups;
+		if (m_size * 2 >= m_mask)
+			grow();
+		uint32_t h = hashKey(key, len);
+		size_t s = h & m_mask;
+		for (; m_slots[s].k; s = (s + 1) & m_mask) {
+			const Slot &o = m_slots[s];
+			if (o.hash == h && o.len == len && memcmp(o.k, key, len) == 0) {
+				++m_stats.hits;
+				m_stats.bytesSaved += len + 1;
+				return o.k;
+			}
+		}
+		char *k = static_cast<char *>(m_chars.alloc(len + 1));
+		memcpy(k, key, len);
+		k[len] = '\0';
+		m_slots[s].k = k;
+		m_slots[s].len = len;
+		m_slots[s].hash = h;
+		++m_size;
+		return k;
+	}
+
+	const char* KeyTable::find(const char *key, size_t len) const
+	{
+		if (m_size == 0)
+			return nullptr;
+		uint32_t h = hashKey(key, len);
+		for (size_t s = h & m_mask; m_slots[s].k; s = (s + 1) & m_mask) {
+			const Slot &o = m_slots[s];
+			if (o.hash == h && o.len == len && memcmp(o.k, key, len) == 0)
+				return o.k;
+		}
+		return nullptr;
+	}
+
+	void KeyTable::clear()
+	{
+		free(m_slots);
+		m_slots = nullptr;
+		m_mask = m_size = 0;
+		m_chars.clear();
+		m_stats = KeyTableStats();
+	}
+
+	void KeyTable::grow()
+	{
+		size_t capacity = m_slots ? (m_mask + 1) * 2 : 64;
+		Slot *slots = static_cast<Slot *>(calloc(capacity, sizeof(Slot)));
+		for (size_t i = 0; m_slots && i <= m_mask; ++i) {
+			if (!m_slots[i].k)
+				continue;
+			size_t s = m_slots[i].hash & (capacity - 1);
+			while (slots[s].k)
+				s = (s + 1) & (capacity - 1);
+			slots[s] = m_slots[i];
+		}
+		free(m_slots);
+		m_slots = slots;
+		m_mask = capacity - 1;
+	}
+
+	ParseResult Document::parse(const char *json, size_t len, unsigned flags)
+	{
+		Context c;
+		c.padded = (flags & PARSE_FLAG_PADDED) != 0;
+		return parse(c, json, len);
+	}
+
+	ParseResult Document::parseInsitu(char *json, size_t len, unsigned flags)
+	{
+		Context c;
+		c.insitu = true;
+		c.padded = (flags & PARSE_FLAG_PADDED) != 0;
+		return parse(c, json, len);
+	}
+
+	ParseResult Document::parseFile(const char *path)
+	{
+		MappedFile f;
+		if (!f.open(path)) {
+			reset();
+			ParseError::fail(PARSE_FILE_ERROR, nullptr, 0, 0);
+			return PARSE_FILE_ERROR;
+		}
+		return parse(f.data(), f.size(), f.padded() ? PARSE_FLAG_PADDED : PARSE_FLAG_NONE);
+	}
+
+	ParseResult Document::parseFileInsitu(const char *path)
+	{
+		MappedFile f;
+		if (!f.open(path, true)) {
+			reset();
+			ParseError::fail(PARSE_FILE_ERROR, nullptr, 0, 0);
+			return PARSE_FILE_ERROR;
+		}
+		Context c;
+		c.insitu = true;
+		c.padded = f.padded();
+		ParseResult res = parse(c, f.data(), f.size());
+		if (res == PARSE_OK)
+			m_file.swap(f);
+		return res;
+	}
+
+	/* null, with the arena and any mapped file let go */
+	void Document::reset()
+	{
+		setNull();
+		m_arena.clear();
+		m_file.close();
+	}
+
+	ParseResult Document::parse(Context &c, const char *json, size_t len)
+	{
+		reset();
+		c.arena = &m_arena;
+		KeyTable *keys = c.keys;
+		if (m_internKeys) {
+			m_keys.clear();
+			c.keys = &m_keys;
+		}
+		ParseResult res = Value::parse(c, json, len);
+		c.arena = nullptr;
+		c.keys = keys;
+		return res;
+	}
+
+	/* a run of whole lines; `owned` holds the bytes when they came from a stream */
+	struct NdjsonBatch {
+		const char *data = nullptr;
+		size_t len = 0;
+		size_t firstLine = 0;
+		size_t lines = 0;
+		size_t seq = 0;
+		std::string owned;
+	};
+
+	static size_t countLines(const char *p, size_t len)
+	{
+		const char *end = p + len;
+		size_t n = 0;
+		while ((p = static_cast<const char *>(memchr(p, '\n', end - p))) != nullptr) {
+			++n;
+			++p;
+		}
+		return len > 0 && end[-1] != '\n' ? n + 1 : n;
+	}
+
+	/* calls f(line number, begin, end) for every line of b that is not blank */
+	template <typename F>
+	static void forEachRecord(const NdjsonBatch &b, NdjsonStats &stats, F f)
+	{
+		const char *p = b.data, *end = b.data + b.len;
+		for (size_t line = b.firstLine; p != end; ++line) {
+			const char *nl = static_cast<const char *>(memchr(p, '\n', end - p));
+			const char *e = nl ? nl : end;
+			++stats.lines;
+			if (skipWhitespace(p, e, false) != e) {
+				++stats.records;
+				f(line, p, e);
+			}
+			p = nl ? nl + 1 : end;
+		}
+	}
+
+	/*
+	 * Batches go from the reading thread to the workers through a bounded
+	 * queue. In ordered mode a worker parses its whole batch, then waits for
+	 * the batch's turn to hand the values over. With one thread, batches are
+	 * parsed on the reading thread as they come.
+	 */
+	class NdjsonPool {
+	public:
+		NdjsonPool(unsigned threads, bool ordered, const NdjsonReader::Callback &cb)
+			: m_cb(cb), m_ordered(ordered), m_maxQueued(2 * threads)
+		{
+			if (threads > 1)
+				for (unsigned i = 0; i < threads; ++i)
+					m_workers.emplace_back(&NdjsonPool::work, this);
+		}
+
+		void push(NdjsonBatch *b)
+		{
+			b->seq = m_seq++;
+			if (m_workers.empty()) {
+				parseUnordered(*b, m_parser, m_doc, m_stats);
+				delete b;
+				return;
+			}
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_queueChanged.wait(lock, [this] { return m_queue.size() < m_maxQueued; });
+			m_queue.push_back(b);
+			m_queueChanged.notify_all();
+		}
+
+		NdjsonStats finish()
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_done = true;
+			}
+			m_queueChanged.notify_all();
+			for (auto &w : m_workers)
+				w.join();
+			return m_stats;
+		}
+	private:
+		const NdjsonReader::Callback &m_cb;
+		bool m_ordered;
+		size_t m_maxQueued;
+		size_t m_seq = 0;
+		std::vector<std::thread> m_workers;
+		std::mutex m_mutex;
+		std::condition_variable m_queueChanged, m_turnChanged;
+		std::deque<NdjsonBatch *> m_queue;
+		bool m_done = false;
+		size_t m_turn = 0;		/* seq of the next batch to deliver, ordered mode */
+		NdjsonStats m_stats;
+		Parser m_parser;	/* for the single-threaded case */
+		Document m_doc;
+
+		void work()
+		{
+			Parser parser;
+			Document doc;
+			NdjsonStats stats;
+			for (;;) {
+				NdjsonBatch *b;
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_queueChanged.wait(lock, [this] { return !m_queue.empty() || m_done; });
+					if (m_queue.empty())
+						break;
+					b = m_queue.front();
+					m_queue.pop_front();
+				}
+				m_queueChanged.notify_all();
+				if (m_ordered)
+					parseOrdered(*b, parser, stats);
+				else
+					parseUnordered(*b, parser, doc, stats);
+				delete b;
+			}
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stats.lines += stats.lines;
+			m_stats.records += stats.records;
+			m_stats.errors += stats.errors;
+		}
+
+		/* one Document, reused for every line */
+		void parseUnordered(const NdjsonBatch &b, Parser &parser, Document &doc, NdjsonStats &stats)
+		{
+			forEachRecord(b, stats, [&](size_t line, const char *p, const char *e) {
+				ParseResult res = parser.parse(doc, p, e - p);
+				if (res != PARSE_OK)
+					++stats.errors;
+				m_cb(line, res, doc);
+			});
+		}
+
+		void parseOrdered(const NdjsonBatch &b, Parser &parser, NdjsonStats &stats)
+		{
+			std::unique_ptr<Value[]> values(new Value[b.lines]);
+			std::unique_ptr<size_t[]> lines(new size_t[b.lines]);
+			std::unique_ptr<ParseResult[]> results(new ParseResult[b.lines]);
+			size_t n = 0;
+			forEachRecord(b, stats, [&](size_t line, const char *p, const char *e) {
+				if ((results[n] = parser.parse(values[n], p, e - p)) != PARSE_OK)
+					++stats.errors;
+				lines[n++] = line;
+			});
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_turnChanged.wait(lock, [this, &b] { return m_turn == b.seq; });
+			}
+			for (size_t i = 0; i < n; ++i)
+				m_cb(lines[i], results[i], values[i]);
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				++m_turn;
+			}
+			m_turnChanged.notify_all();
+		}
+	};
+
+	NdjsonReader::NdjsonReader(unsigned threads, size_t batchSize)
+		: m_threads(threads), m_batchSize(batchSize)
+	{
+		assert(batchSize > 0);
+		if (m_threads == 0)
+			m_threads = std::thread::hardware_concurrency();
+		if (m_threads == 0)
+			m_threads = 1;
+	}
+
+	NdjsonStats NdjsonReader::read(const char *data, size_t len, const Callback &cb)
+	{
+		assert(data != nullptr || len == 0);
+		NdjsonPool pool(m_threads, m_ordered, cb);
+		size_t line = 1;
+		for (size_t pos = 0; pos < len;) {
+			size_t cut = len - pos > m_batchSize ? pos + m_batchSize : len;
+			if (cut < len) {
+				/* extend to the end of the line the cut falls in */
+				auto nl = static_cast<const char *>(memchr(data + cut - 1, '\n', len - cut + 1));
+				cut = nl ? nl - data + 1 : len;
+			}
+			NdjsonBatch *b = new NdjsonBatch;
+			b->data = data + pos;
+			b->len = cut - pos;
+			b->firstLine = line;
+			line += b->lines = countLines(b->data, b->len);
+			pool.push(b);
+			pos = cut;
+		}
+		return pool.finish();
+	}
+
+	NdjsonStats NdjsonReader::read(FILE *f, const Callback &cb)
+	{
+		NdjsonPool pool(m_threads, m_ordered, cb);
+		std::string carry;	/* the unfinished last line of the previous read */
+		size_t line = 1;
+		for (bool eof = false; !eof;) {
+			std::string buf;
+			buf.swap(carry);
+			size_t have = buf.size();
+			buf.resize(have + m_batchSize);
+			size_t got = fread(&buf[have], 1, m_batchSize, f);
+			buf.resize(have + got);
+			eof = got < m_batchSize;
+			if (!eof) {
+				size_t nl = buf.rfind('\n');
+				if (nl == std::string::npos) {
+					/* a line longer than a batch: keep reading */
+					carry.swap(buf);
+					continue;
+				}
+				carry.assign(buf, nl + 1, std::string::npos);
+				buf.resize(nl + 1);
+			}
+			if (buf.empty())
+				continue;
+			NdjsonBatch *b = new NdjsonBatch;
+			b->owned.swap(buf);
+			b->data = b->owned.data();
+			b->len = b->owned.size();
+			b->firstLine = line;
+			line += b->lines = countLines(b->data, b->len);
+			pool.push(b);
+		}
+		return pool.finish();
+	}
+
+	/* stage two writes scalars through the grammar's own string, number and literal code */
+	struct Tape::Builder {
+		struct Level { size_t open, count; };
+
+		uint64_t *words, *w;
+		char *strings, *s;
+		const char *json;
+
+		void put(Tag t, uint64_t payload) { *w++ = uint64_t(t) << 56 | payload; }
+		bool onNull() { put(TAG_NULL, 0); return true; }
+		bool onBool(bool b) { put(b ? TAG_TRUE : TAG_FALSE, 0); return true; }
+		bool onNumber(double d)
+		{
+			put(TAG_DOUBLE, 0);
+			memcpy(w++, &d, sizeof(d));
+			return true;
+		}
+		bool onInt64(int64_t i) { put(TAG_INT64, 0); *w++ = static_cast<uint64_t>(i); return true; }
+		bool onUint64(uint64_t u) { put(TAG_UINT64, 0); *w++ = u; return true; }
+		bool onString(const char *str, size_t len)
+		{
+			put(TAG_STRING, s - strings);
+			uint32_t n = static_cast<uint32_t>(len);
+			memcpy(s, &n, sizeof(n));
+			if (len > 0)
+				memcpy(s + sizeof(n), str, len);
+			s[sizeof(n) + len] = '\0';
+			s += sizeof(n) + len + 1;
+			return true;
+		}
+		bool onKey(const char *str, size_t len) { return onString(str, len); }
+
+		void open(Context &c, Tag t)
+		{
+			Level *l = static_cast<Level *>(c.push(sizeof(Level)));
+			l->open = w - words;
+			l->count = 0;
+			put(t, 0);
+		}
+		void close(Context &c)
+		{
+			Level *l = static_cast<Level *>(c.pop(sizeof(Level)));
+			size_t end = w - words;
+			words[l->open] |= end - l->open;
+			put(words[l->open] >> 56 == TAG_ARRAY ? TAG_ARRAY_END : TAG_OBJECT_END, l->count);
+		}
+		Level& top(Context &c) { return reinterpret_cast<Level *>(c.stack + c.top)[-1]; }
+		bool inArray(Context &c) { return words[top(c).open] >> 56 == TAG_ARRAY; }
+
+		/* parseLazy: check a string as parseStringRaw would, without copying it out */
+		ParseResult lazyString(Context &c)
+		{
+			const char *p = c.json + 1;
+			for (;;) {
+				p = scanString(p, c.end, c.padded);
+				if (p == c.end) {
+					c.json = p;
+					return PARSE_MISS_QUOTATION_MARK;
+				}
+				char ch = *p++;
+				if (ch == '"')
+					break;
+				if (ch != '\\') {
+					c.json = p - 1;
+					return PARSE_INVALID_STRING_CHAR;
+				}
+				const char *escape = p - 1;
+				switch (peek(p++, c.end)) {
+				case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+					break;
+				case 'u': {
+					unsigned u;
+					ParseResult res = Value::parseEscapedUnicode(p, c.end, u);
+					if (res != PARSE_OK) {
+						c.json = escape;
+						return res;
+					}
+					break;
+				}
+				default:
+					c.json = escape;
+					return PARSE_INVALID_STRING_ESCAPE;
+				}
+			}
+			put(TAG_LAZY_STRING, c.json - json);
+			c.json = p;
+			return PARSE_OK;
+		}
+		/*
+		 * parseLazy: check a number's syntax and keep its extent. Only an
+		 * exponent or a few hundred digits can overflow a double, so those
+		 * are converted now to report PARSE_NUMBER_TOO_BIG where parse() does.
+		 */
+		ParseResult lazyNumber(Context &c)
+		{
+			const char *p = c.json;
+			if (*p == '-')
+				++p;
+			if (peek(p, c.end) == '0')
+				++p;
+			else if (ISDIGIT1TO9(peek(p, c.end))) {
+				while (ISDIGIT(peek(p, c.end)))
+					++p;
+			} else
+				return PARSE_INVALID_VALUE;
+			if (peek(p, c.end) == '.') {
+				++p;
+				if (!ISDIGIT(peek(p, c.end)))
+					return PARSE_INVALID_VALUE;
+				while (ISDIGIT(peek(p, c.end)))
+					++p;
+			}
+			if (peek(p, c.end) == 'e' || peek(p, c.end) == 'E' || p - c.json > 300)
+				return Value::parseNumber(c, *this);
+			put(TAG_LAZY_NUMBER, c.json - json);
+			*w++ = p - c.json;
+			c.json = p;
+			return PARSE_OK;
+		}
+	};
+
+	template <typename T>
+	static void reserveBuffer(T *&p, size_t &capacity, size_t n)
+	{
+		if (n > capacity) {
+			free(p);
+			p = static_cast<T *>(malloc(sizeof(T) * n));
+			capacity = n;
+		}
+	}
+
+	/* a number or literal ends where a blank, a structural character or a quote starts */
+	static inline bool scalarEnded(const char *p, const char *end)
+	{
+		if (p == end)
+			return true;
+		switch (*p) {
+		case ' ': case '\t': case '\n': case '\r':
+		case ',': case ':': case '[': case ']': case '{': case '}': case '"':
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	Tape::~Tape()
+	{
+		free(m_words);
+		free(m_strings);
+		free(m_index);
+	}
+
+	ParseResult Tape::parse(const char *json, size_t len, unsigned flags, bool lazy)
+	{
+		assert(json != nullptr || len == 0);
+		m_ok = false;
+		m_size = m_stringsSize = 0;
+		if (len >= UINT32_MAX) {
+			m_json = nullptr;
+			m_len = m_structurals = 0;
+			ParseError::fail(PARSE_INPUT_TOO_LARGE, nullptr, 0, 0);
+			return PARSE_INPUT_TOO_LARGE;
+		}
+		m_json = json;
+		m_len = len;
+
+		reserveBuffer(m_index, m_indexCapacity, len + 1);
+		const size_t n = m_structurals = indexStructurals(json, len, m_index);
+		/*
+		 * Nothing grows below: a structural makes at most two words, and a
+		 * string at most its source less the quotes, plus a length and a
+		 * terminator.
+		 */
+		reserveBuffer(m_words, m_wordsCapacity, 2 * n + 1);
+		reserveBuffer(m_strings, m_stringsCapacity, len + len / 2 * 3 + 1);
+
+		Context &c = m_c;
+		c.json = json;
+		c.end = json + len;
+		c.padded = (flags & PARSE_FLAG_PADDED) != 0;
+		c.top = 0;
+		Builder b = { m_words, m_words, m_strings, m_strings, json };
+		const uint32_t *p = m_index, *end = m_index + n;
+		enum { VALUE, KEY, AFTER_VALUE } state = VALUE;
+		ParseResult res = PARSE_OK;
+		while (res == PARSE_OK) {
+			switch (state) {
+			case VALUE:
+				if (p == end) {
+					c.json = c.end;
+					res = PARSE_EXPECT_VALUE;
+					break;
+				}
+				c.json = json + *p++;
+				switch (*c.json) {
+				case '[':
+				case '{': {
+					if (c.top / sizeof(Builder::Level) >= c.maxDepth) {
+						res = PARSE_DEPTH_EXCEEDED;
+						break;
+					}
+					bool array = *c.json == '[';
+					b.open(c, array ? TAG_ARRAY : TAG_OBJECT);
+					if (p != end && json[*p] == (array ? ']' : '}')) {
+						++p;
+						b.close(c);
+						state = AFTER_VALUE;
+					} else {
+						state = array ? VALUE : KEY;
+					}
+					continue;
+				}
+				case '"': res = lazy ? b.lazyString(c) : Value::parseString(c, b, false); break;
+				case 'n': res = Value::parseLiteral(c, b, "null"); break;
+				case 't': res = Value::parseLiteral(c, b, "true"); break;
+				case 'f': res = Value::parseLiteral(c, b, "false"); break;
+				default:
+					if (*c.json != '-' && !ISDIGIT(*c.json))
+						res = PARSE_INVALID_VALUE;
+					else
+						res = lazy ? b.lazyNumber(c) : Value::parseNumber(c, b);
+					break;
+				}
+				if (res == PARSE_OK && !scalarEnded(c.json, c.end))
+					res = c.top == 0 ? PARSE_ROOT_NOT_SINGULAR
+						: b.inArray(c) ? PARSE_MISS_COMMA_OR_SQUARE_BRACKET : PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+				state = AFTER_VALUE;
+				break;
+			case KEY:
+				if (p == end || json[*p] != '"') {
+					c.json = p == end ? c.end : json + *p;
+					res = PARSE_MISS_KEY;
+					break;
+				}
+				c.json = json + *p++;
+				if ((lazy ? b.lazyString(c) : Value::parseString(c, b, true)) != PARSE_OK) {
+					res = PARSE_MISS_KEY;
+				} else if (p == end || json[*p] != ':') {
+					c.json = p == end ? c.end : json + *p;
+					res = PARSE_MISS_COLON;
+				}
+				++p;
+				state = VALUE;
+				break;
+			case AFTER_VALUE: {
+				if (c.top == 0) {
+					if (p != end) {
+						c.json = json + *p;
+						res = PARSE_ROOT_NOT_SINGULAR;
+					} else {
+						m_size = b.w - m_words;
+						m_stringsSize = b.s - m_strings;
+						b.put(TAG_END, 0);
+						m_ok = true;
+						return PARSE_OK;
+					}
+					break;
+				}
+				++b.top(c).count;
+				bool array = b.inArray(c);
+				c.json = p == end ? c.end : json + *p;
+				char ch = p == end ? '\0' : json[*p++];
+				if (ch == ',')
+					state = array ? VALUE : KEY;
+				else if (ch == (array ? ']' : '}'))
+					b.close(c);
+				else
+					res = array ? PARSE_MISS_COMMA_OR_SQUARE_BRACKET : PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+				break;
+			}
+			}
+		}
+		c.top = 0;
+		ParseError::fail(res, json, len, c.json - json);
+		return res;
+	}
+
+	/* decodes a parseLazy word in place; it was validated, so this cannot fail */
+	void Tape::resolve(const uint64_t *word) const
+	{
+		Context &c = m_c;
+		c.json = m_json + (*word & PAYLOAD);
+		c.end = m_json + m_len;
+		Builder b = { m_words, const_cast<uint64_t *>(word), m_strings, m_strings + m_stringsSize, m_json };
+		if (*word >> 56 == TAG_LAZY_STRING) {
+			Value::parseString(c, b, false);
+			m_stringsSize = b.s - m_strings;
+		} else {
+			Value::parseNumber(c, b);
+		}
+	}
+
+	Tape::Cursor Tape::Cursor::getArrayElement(size_t index) const
+	{
+		assert(tag() == TAG_ARRAY && index < getArraySize());
+		Cursor e = first();
+		while (index--)
+			e = e.next();
+		return e;
+	}
+
+	const char* Tape::Cursor::getObjectKey(size_t index) const
+	{
+		assert(tag() == TAG_OBJECT && index < getObjectSize());
+		Cursor k = first();
+		while (index--)
+			k = k.next().next();
+		return k.getString();
+	}
+
+	size_t Tape::Cursor::getObjectKeyLength(size_t index) const
+	{
+		assert(tag() == TAG_OBJECT && index < getObjectSize());
+		Cursor k = first();
+		while (index--)
+			k = k.next().next();
+		return k.getStringLength();
+	}
+
+	Tape::Cursor Tape::Cursor::getObjectValue(size_t index) const
+	{
+		assert(tag() == TAG_OBJECT && index < getObjectSize());
+		Cursor k = first();
+		while (index--)
+			k = k.next().next();
+		return k.next();
+	}
+
+	Tape::Cursor Tape::Cursor::findMember(const char *key, size_t len) const
+	{
+		assert(tag() == TAG_OBJECT);
+		assert(key != nullptr || len == 0);
+		/* a key without quotes or backslashes can be matched against lazy keys as written */
+		bool plain = memchr(key, '"', len) == nullptr && memchr(key, '\\', len) == nullptr;
+		for (Cursor k = first(); k; k = k.next().next())
+			if (k.keyEquals(key, len, plain))
+				return k.next();
+		return Cursor();
+	}
+
+	bool Tape::Cursor::keyEquals(const char *key, size_t len, bool plain) const
+	{
+		if (tag() == TAG_LAZY_STRING && plain) {
+			const char *s = m_t->m_json + (*m_w & PAYLOAD) + 1, *end = m_t->m_json + m_t->m_len;
+			if (static_cast<size_t>(end - s) > len && memcmp(s, key, len) == 0 && s[len] == '"')
+				return true;
+			/* an unescaped key can only be key as written */
+			if (*scanString(s, end, m_t->m_c.padded) == '"')
+				return false;
+		}
+		return getStringLength() == len && memcmp(getString(), key, len) == 0;
+	}
+
+	bool FixedSink::write(const char *s, size_t len)
+	{
+		if (len > m_capacity - m_size)
+			return false;
+		memcpy(m_buf + m_size, s, len);
+		m_size += len;
+		return true;
+	}
+
+	bool FdSink::write(const char *s, size_t len)
+	{
+		while (len > 0) {
+#ifdef _WIN32
+			int n = _write(m_fd, s, static_cast<unsigned>(len < INT_MAX ? len : INT_MAX));
+#else
+			ssize_t n = ::write(m_fd, s, len);
+			if (n < 0 && errno == EINTR)
+				continue;
+#endif
+			if (n <= 0)
+				return false;
+			s += n;
+			len -= static_cast<size_t>(n);
+		}
+		return true;
+	}
+
+	bool FdSink::writev(const char *a, size_t alen, const char *b, size_t blen)
+	{
+#ifdef _WIN32
+		return write(a, alen) && write(b, blen);
+#else
+		struct iovec v[2] = { { const_cast<char *>(a), alen }, { const_cast<char *>(b), blen } };
+		int i = 0;
+		for (;;) {
+			while (i < 2 && v[i].iov_len == 0)
+				++i;
+			if (i == 2)
+				return true;
+			ssize_t n = ::writev(m_fd, v + i, 2 - i);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return false;
+			/* a short write can end anywhere, even inside the first piece */
+			size_t done = static_cast<size_t>(n);
+			for (; done >= v[i].iov_len; ++i) {
+				done -= v[i].iov_len;
+				v[i].iov_len = 0;
+				if (i == 1)
+					break;
+			}
+			if (done > 0) {
+				v[i].iov_base = static_cast<char *>(v[i].iov_base) + done;
+				v[i].iov_len -= done;
+			}
+		}
+#endif
+	}
+
+	Writer::Writer(OutputSink &sink, size_t bufferSize)
+		: m_sink(sink), m_bufferSize(bufferSize)
+	{
+		assert(bufferSize > 0);
+		m_c.stack = static_cast<char *>(malloc(m_c.size = bufferSize + AJ_PARSE_STRINGIFY_INIT_SIZE));
+	}
+
+	/* the separator a value needs in front, and the checks that it may come here */
+	void Writer::beforeValue()
+	{
+		assert(!m_complete);
+		if (m_open.empty())
+			return;
+		if (m_open.back() == '{') {
+			assert(m_keyed);
+			m_keyed = false;
+		} else if (m_comma) {
+			PUTC(m_c, ',');
+		}
+	}
+
+	bool Writer::afterValue()
+	{
+		m_comma = true;
+		m_complete = m_open.empty();
+		if (m_c.top >= m_bufferSize)
+			flush();
+		return m_ok;
+	}
+
+	bool Writer::null()
+	{
+		beforeValue();
+		PUTS(m_c, "null", 4);
+		return afterValue();
+	}
+
+	bool Writer::boolean(bool b)
+	{
+		beforeValue();
+		if (b)
+			PUTS(m_c, "true", 4);
+		else
+			PUTS(m_c, "false", 5);
+		return afterValue();
+	}
+
+	bool Writer::number(double d)
+	{
+		beforeValue();
+		putDouble(m_c, d);
+		return afterValue();
+	}
+
+	bool Writer::int64(int64_t i)
+	{
+		beforeValue();
+		putInt64(m_c, i);
+		return afterValue();
+	}
+
+	bool Writer::uint64(uint64_t u)
+	{
+		beforeValue();
+		putUint64(m_c, u);
+		return afterValue();
+	}
+
+	bool Writer::string(const char *s, size_t len)
+	{
+		assert(s != nullptr || len == 0);
+		beforeValue();
+		putString(s, len);
+		return afterValue();
+	}
+
+	bool Writer::startObject()
+	{
+		beforeValue();
+		PUTC(m_c, '{');
+		m_open += '{';
+		m_comma = false;
+		return m_ok;
+	}
+
+	bool Writer::key(const char *k, size_t len)
+	{
+		assert(!m_open.empty() && m_open.back() == '{' && !m_keyed);
+		assert(k != nullptr || len == 0);
+		if (m_comma)
+			PUTC(m_c, ',');
+		putString(k, len);
+		PUTC(m_c, ':');
+		m_keyed = true;
+		if (m_c.top >= m_bufferSize)
+			flush();
+		return m_ok;
+	}
+
+	bool Writer::endObject()
+	{
+		assert(!m_open.empty() && m_open.back() == '{' && !m_keyed);
+		m_open.pop_back();
+		PUTC(m_c, '}');
+		return afterValue();
+	}
+
+	bool Writer::startArray()
+	{
+		beforeValue();
+		PUTC(m_c, '[');
+		m_open += '[';
+		m_comma = false;
+		return m_ok;
+	}
+
+	bool Writer::endArray()
+	{
+		assert(!m_open.empty() && m_open.back() == '[');
+		m_open.pop_back();
+		PUTC(m_c, ']');
+		return afterValue();
+	}
+
+	bool Writer::value(const Value &v)
+	{
+		beforeValue();
+		/* a whole DOM drains into the sink as it is written, not after */
+		m_c.sink = m_ok ? &m_sink : nullptr;
+		m_c.flushAt = m_bufferSize;
+		if (v.stringifyValue(m_c) != STRINGIFY_OK)
+			m_ok = false;
+		m_c.sink = nullptr;
+		return afterValue();
+	}
+
+	/* a long string drains into the sink in pieces, as in value() */
+	void Writer::putString(const char *s, size_t len)
+	{
+		m_c.sink = m_ok ? &m_sink : nullptr;
+		m_c.flushAt = m_bufferSize;
+		if (Value::stringifyString(m_c, s ? s : "", len) != STRINGIFY_OK)
+			m_ok = false;
+		m_c.sink = nullptr;
+	}
+
+	/* after a failure output is dropped, so the buffer stays bounded */
+	bool Writer::flush()
+	{
+		if (m_c.top > 0 && m_ok)
+			m_ok = m_sink.write(m_c.stack, m_c.top);
+		m_c.top = 0;
+		return m_ok;
 	}
 }
@@ -2,8 +2,16 @@
 #define AJson_H
 
 #include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <functional>
 #include <string>
+#include <utility>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
 
 #ifndef AJ_PARSE_STACK_INIT_SIZE
 #define AJ_PARSE_STACK_INIT_SIZE 256
@@ -11,6 +19,33 @@
 #ifndef AJ_PARSE_STRINGIFY_INIT_SIZE
 #define AJ_PARSE_STRINGIFY_INIT_SIZE 256
 #endif
+#ifndef AJ_PARSE_MAX_DEPTH
+#define AJ_PARSE_MAX_DEPTH 1024	/* containers open at once before a parse fails with PARSE_DEPTH_EXCEEDED */
+#endif
+#ifndef AJ_PARSE_PADDING
+#define AJ_PARSE_PADDING 32
+#endif
+#ifndef AJ_ARENA_CHUNK_SIZE
+#define AJ_ARENA_CHUNK_SIZE (64 * 1024)
+#endif
+#ifndef AJ_OBJECT_INDEX_MIN
+#define AJ_OBJECT_INDEX_MIN 16	/* members from which key lookups use a hash index */
+#endif
+#ifndef AJ_NDJSON_BATCH_SIZE
+#define AJ_NDJSON_BATCH_SIZE (1024 * 1024)
+#endif
+#ifndef AJ_STRINGIFY_BUFFER_SIZE
+#define AJ_STRINGIFY_BUFFER_SIZE (64 * 1024)	/* bytes stringifyTo() collects before writing them out */
+#endif
+#ifndef AJ_WRITER_BUFFER_SIZE
+#define AJ_WRITER_BUFFER_SIZE 4096	/* bytes a Writer collects before handing them to its sink */
+#endif
+/*
+ * Define AJ_COMPACT_VALUE for 16-byte Values instead of 24: string lengths
+ * and element/member counts become 32-bit, and strings and keys of up to
+ * 13 bytes are stored inside the Value instead of their own allocation.
+ * Everything including AJson.h must be built with the same setting.
+ */
 
 namespace AJson {
 	enum ValueType {
@@ -20,7 +55,9 @@ namespace AJson {
 		VALUE_TYPE_NUMBER,
 		VALUE_TYPE_STRING,
 		VALUE_TYPE_ARRAY,
-		VALUE_TYPE_OBJECT
+		VALUE_TYPE_OBJECT,
+		VALUE_TYPE_INT64,	/* integer literals that fit, kept exact */
+		VALUE_TYPE_UINT64	/* only for values above INT64_MAX */
 	};
 
 	enum ParseResult {
@@ -37,28 +74,277 @@ namespace AJson {
 		PARSE_MISS_COMMA_OR_SQUARE_BRACKET,
 		PARSE_MISS_KEY,
 		PARSE_MISS_COLON,
-		PARSE_MISS_COMMA_OR_CURLY_BRACKET
+		PARSE_MISS_COMMA_OR_CURLY_BRACKET,
+		PARSE_ABORTED,		/* a Handler callback returned false */
+		PARSE_FILE_ERROR,	/* the file could not be opened or mapped, see errno */
+		PARSE_DEPTH_EXCEEDED,	/* more containers open at once than the maximum depth */
+		PARSE_INPUT_TOO_LARGE	/* over 4 GB for a Tape; with AJ_COMPACT_VALUE, a string or container past 32 bits of length */
+	};
+
+	enum ParseFlag {
+		PARSE_FLAG_NONE = 0,
+		/* at least AJ_PARSE_PADDING readable bytes follow the input, scanners may read ahead into them */
+		PARSE_FLAG_PADDED = 1
 	};
 
+	class Value;
+	class Document;
+	class Tape;
+	class PushParser;
+
+	/*
+	 * Where a parse failed: the byte offset it stopped at, with the line,
+	 * column and the text around it copied out of the input as it fails,
+	 * so the input may go right after. A PushParser keeps no input and has
+	 * only the offset into everything fed to it.
+	 */
+	class ParseError {
+	public:
+		ParseResult result() const { return m_result; }
+		size_t offset() const { return m_offset; }
+		/* 1-based, 0 without the input; the column counts bytes, and "\n", "\r\n" or "\r" ends a line */
+		size_t line() const { return m_line; }
+		size_t column() const { return m_column; }
+		/* the line around the offset, up to width (at most 256) bytes either side, then a second line with '^' under it */
+		std::string snippet(size_t width = 32) const;
+	private:
+		friend class Value;
+		friend class Document;
+		friend class Tape;
+		friend class PushParser;
+
+		ParseResult m_result = PARSE_OK;
+		size_t m_offset = 0;
+		/* worked out on failure, as the input need not outlive the parse */
+		size_t m_line = 0, m_column = 0;
+		std::string m_window;	/* the bytes of the line around the offset */
+		size_t m_windowAt = 0;
+
+		static void fail(ParseResult, const char *json, size_t len, size_t offset);
+	};
+
+	/* the calling thread's last failed parse; successful ones leave it as it was */
+	const ParseError& lastParseError();
+
 	enum StringifyResult {
 		STRINGIFY_OK,
-		STRINGIFY_BAD
+		STRINGIFY_BAD,
+		STRINGIFY_WRITE_ERROR	/* the sink failed, see errno for a file or descriptor */
+	};
+
+	/* layout for Value::stringify(const PrettyFormat &) */
+	struct PrettyFormat {
+		unsigned indent = 4;		/* indentChars per level */
+		char indentChar = ' ';		/* or '\t' */
+		const char *newline = "\n";	/* or "\r\n" */
+		bool sortKeys = false;		/* members in key byte order, duplicates as they were */
 	};
 
+	enum SimdLevel {
+		SIMD_NONE,	/* portable 8-byte word scanning */
+		SIMD_SSE2,
+		SIMD_AVX2
+	};
+
+	/*
+	 * Instruction set used by the whitespace and string scanners, the best
+	 * the CPU supports unless lowered with setSimdLevel() (which returns the
+	 * level actually in effect). Build with AJ_NO_SIMD to leave out the
+	 * x86 kernels.
+	 */
+	SimdLevel simdLevel();
+	SimdLevel setSimdLevel(SimdLevel);
+
+	/* monotonic allocator: memory is only given back all at once */
+	class Arena {
+	public:
+		explicit Arena(size_t chunkSize = AJ_ARENA_CHUNK_SIZE);
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+		~Arena() { release(); }
+
+		void* alloc(size_t);
+		void clear();
+		void release();
+
+		size_t used() const { return m_used; }
+		size_t capacity() const { return m_capacity; }
+		size_t chunks() const;
+	private:
+		struct Chunk { Chunk *next; size_t size, used; };
+		Chunk *m_head = nullptr;
+		size_t m_chunkSize;
+		size_t m_used = 0, m_capacity = 0;
+	};
+
+	struct KeyTableStats {
+		size_t lookups = 0;		/* keys interned */
+		size_t hits = 0;		/* ... that were already in the table */
+		size_t bytesSaved = 0;	/* key copies the hits did not make, terminators included */
+	};
+
+	/*
+	 * Interns object keys: each distinct key is stored once and parsed
+	 * objects point at the stored copy, so a document that repeats a few
+	 * keys in every record does not copy them per object, and freeing the
+	 * tree skips its keys. Give one to a Parser to share it between
+	 * documents; it must then outlive every value parsed with it. Keys are
+	 * only dropped by clear() or the destructor. Not thread-safe.
+	 */
+	class KeyTable {
+	public:
+		explicit KeyTable(size_t chunkSize = 4096) : m_chars(chunkSize) {}
+		KeyTable(const KeyTable&) = delete;
+		KeyTable& operator=(const KeyTable&) = delete;
+		~KeyTable() { free(m_slots); }
+
+		/* the stored copy of key, added if missing; always terminated */
+		const char* intern(const char *key, size_t len);
+		/* the stored copy of key, or null */
+		const char* find(const char *key, size_t len) const;
+		const char* find(const char *key) const { return find(key, strlen(key)); }
+		void clear();
+
+		size_t size() const { return m_size; }
+		size_t bytes() const { return m_chars.used(); }
+		const KeyTableStats& stats() const { return m_stats; }
+	private:
+		struct Slot { const char *k; size_t len; uint32_t hash; };
+		Arena m_chars;
+		Slot *m_slots = nullptr;
+		size_t m_mask = 0;
+		size_t m_size = 0;
+		KeyTableStats m_stats;
+
+		void grow();
+	};
+
+	/*
+	 * A whole regular file mapped into memory, read-only, or private and
+	 * writable (copy-on-write, the file never changes) for in-situ parsing.
+	 * Where mmap is unavailable the file is read into a buffer instead.
+	 */
+	class MappedFile {
+	public:
+		MappedFile() = default;
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		~MappedFile() { close(); }
+
+		bool open(const char *path, bool writable = false);
+		void close();
+		void swap(MappedFile &);
+
+		char* data() const { return m_data; }
+		size_t size() const { return m_size; }
+		/* AJ_PARSE_PADDING readable bytes follow the contents, see PARSE_FLAG_PADDED */
+		bool padded() const { return m_padded; }
+	private:
+		char *m_data = nullptr;
+		size_t m_size = 0;
+		size_t m_mapped = 0;	/* length of the mapping, 0 for a buffer */
+		bool m_padded = false;
+	};
+
+	class OutputSink;
+
+	/* per-call parse/stringify state, so independent calls never share a stack */
 	struct Context {
 		const char *json = nullptr;
+		const char *end = nullptr;	/* input is [json, end), not necessarily terminated */
 		char* stack = nullptr;
-		size_t size, top;
+		size_t size = 0, top = 0;
+		size_t peak = 0;	/* highest top since the last reset */
+		size_t grows = 0;	/* reallocs of stack */
+		Arena *arena = nullptr;	/* where tree nodes and strings come from, malloc if null */
+		bool insitu = false;	/* json is writable and strings are unescaped in place */
+		bool padded = false;	/* see PARSE_FLAG_PADDED */
+		KeyTable *keys = nullptr;	/* object keys are interned here when set */
+		OutputSink *sink = nullptr;	/* stringify: the stack is written here whenever it reaches flushAt */
+		size_t flushAt = 0;
+		size_t maxDepth = AJ_PARSE_MAX_DEPTH;
+
+		Context() = default;
+		Context(const Context&) = delete;
+		Context& operator=(const Context&) = delete;
+		~Context() { free(stack); }
+
+		void* push(size_t);
+		void* pop(size_t);
+		void* alloc(size_t n) { return arena ? arena->alloc(n) : malloc(n); }
+		void dealloc(void *p) { if (!arena) free(p); }
+		void deallocKey(char *k) { if (!insitu) dealloc(k); }
+	};
+
+	/*
+	 * SAX events, in document order. Strings and keys are unescaped but only
+	 * valid during the call (after an in-situ parse they point into the
+	 * buffer). Return false from any callback to stop the parse with
+	 * PARSE_ABORTED; integers default to onNumber().
+	 */
+	class Handler {
+	public:
+		virtual ~Handler() {}
+		virtual bool onNull() { return true; }
+		virtual bool onBool(bool) { return true; }
+		virtual bool onNumber(double) { return true; }
+		virtual bool onInt64(int64_t i) { return onNumber(static_cast<double>(i)); }
+		virtual bool onUint64(uint64_t u) { return onNumber(static_cast<double>(u)); }
+		virtual bool onString(const char *, size_t) { return true; }
+		virtual bool onStartObject() { return true; }
+		virtual bool onKey(const char *, size_t) { return true; }
+		virtual bool onEndObject(size_t memberCount) { (void)memberCount; return true; }
+		virtual bool onStartArray() { return true; }
+		virtual bool onEndArray(size_t elementCount) { (void)elementCount; return true; }
 	};
 
+	/* parse without building a tree, reporting to a Handler */
+	ParseResult parse(Handler &, const char *, size_t, unsigned flags = PARSE_FLAG_NONE);
+	inline ParseResult parse(Handler &h, const char *json) { return parse(h, json, strlen(json)); }
+	ParseResult parseInsitu(Handler &, char *, size_t, unsigned flags = PARSE_FLAG_NONE);
+	inline ParseResult parseInsitu(Handler &h, char *json) { return parseInsitu(h, json, strlen(json)); }
+
 	struct Member;
+	class Parser;
 
 	class Value {
+		friend class Parser;
+		friend class PushParser;
+		friend class Document;
+		friend class Tape;
+		friend class Writer;
+		friend ParseResult parse(Handler &, const char *, size_t, unsigned);
+		friend ParseResult parseInsitu(Handler &, char *, size_t, unsigned);
 	public:
+		Value() = default;
+		/* copies are explicit, see deepCopy() */
+		Value(const Value&) = delete;
+		Value& operator=(const Value&) = delete;
+		/*
+		 * Moves take the tree and leave v null, except out of a Document: an
+		 * arena-backed v is deep-copied, so the result never dangles.
+		 */
+		Value(Value &&v) noexcept;
+		Value& operator=(Value &&v) noexcept { Value t(std::move(v)); swap(t); return *this; }
 		~Value() { freeMem(); }
-		ParseResult parse(const char *);
+		/* exchanges the trees as they are, arena-backed or not */
+		void swap(Value &) noexcept;
+		/* a tree of the value's own, with every string and key copied */
+		Value deepCopy() const;
+
+		ParseResult parse(const char *json) { return parse(json, strlen(json)); }
+		ParseResult parse(const char *, size_t, unsigned flags = PARSE_FLAG_NONE);
+		ParseResult parse(const std::string &json) { return parse(json.data(), json.size()); }
+#if __cplusplus >= 201703L
+		ParseResult parse(std::string_view json) { return parse(json.data(), json.size()); }
+#endif
+		/* destructive: strings are unescaped inside the buffer and point into it, so it must outlive the value */
+		ParseResult parseInsitu(char *json) { return parseInsitu(json, strlen(json)); }
+		ParseResult parseInsitu(char *, size_t, unsigned flags = PARSE_FLAG_NONE);
+		/* maps the file and parses straight from the mapping */
+		ParseResult parseFile(const char *path);
 
-		ValueType  type() const { return m_type; }
+		ValueType  type() const { return static_cast<ValueType>(m_type); }
 		void setNull() { freeMem(); }
 		void setBool(bool b)
 		{
@@ -69,22 +355,62 @@ namespace AJson {
 			assert(m_type == VALUE_TYPE_TRUE || m_type == VALUE_TYPE_FALSE);
 			return m_type == VALUE_TYPE_TRUE;
 		}
+		bool isNumber() const
+		{
+			return m_type == VALUE_TYPE_NUMBER || m_type == VALUE_TYPE_INT64 || m_type == VALUE_TYPE_UINT64;
+		}
 		void setNumber(double n)
 		{
 			freeMem(); m_n = n; m_type = VALUE_TYPE_NUMBER;
 		}
+		/* any number, integers are converted */
 		double getNumber() const
 		{
-			assert(m_type == VALUE_TYPE_NUMBER); return m_n;
+			assert(isNumber());
+			return m_type == VALUE_TYPE_NUMBER ? m_n
+				: m_type == VALUE_TYPE_INT64 ? static_cast<double>(m_i) : static_cast<double>(m_u);
+		}
+		void setInt64(int64_t i)
+		{
+			freeMem(); m_i = i; m_type = VALUE_TYPE_INT64;
+		}
+		int64_t getInt64() const
+		{
+			assert(m_type == VALUE_TYPE_INT64); return m_i;
+		}
+		/* values up to INT64_MAX are stored as VALUE_TYPE_INT64 */
+		void setUint64(uint64_t u)
+		{
+			freeMem();
+			if (u <= INT64_MAX) {
+				m_i = static_cast<int64_t>(u); m_type = VALUE_TYPE_INT64;
+			} else {
+				m_u = u; m_type = VALUE_TYPE_UINT64;
+			}
+		}
+		uint64_t getUint64() const
+		{
+			assert(m_type == VALUE_TYPE_UINT64 || (m_type == VALUE_TYPE_INT64 && m_i >= 0));
+			return m_type == VALUE_TYPE_UINT64 ? m_u : static_cast<uint64_t>(m_i);
 		}
 		void setString(const char *, size_t);
 		const char* getString() const
 		{
-			assert(m_type == VALUE_TYPE_STRING); return m_s.s;
+			assert(m_type == VALUE_TYPE_STRING);
+#ifdef AJ_COMPACT_VALUE
+			if (m_flags & VALUE_FLAG_INLINE)
+				return inlineChars();
+#endif
+			return m_s.s;
 		}
 		size_t getStringLength() const
 		{
-			assert(m_type == VALUE_TYPE_STRING); return m_s.len;
+			assert(m_type == VALUE_TYPE_STRING);
+#ifdef AJ_COMPACT_VALUE
+			if (m_flags & VALUE_FLAG_INLINE)
+				return INLINE_MAX - inlineChars()[INLINE_MAX];
+#endif
+			return m_s.len;
 		}
 		size_t getArraySize() const
 		{
@@ -108,45 +434,639 @@ namespace AJson {
 		size_t getObjectKeyLength(size_t) const;
 		Value* getObjectValue(size_t);
 		Value* getObjectValue(size_t) const;
+		/*
+		 * The first member named key, or null. Objects of AJ_OBJECT_INDEX_MIN
+		 * members or more build a hash index on the first lookup (safe from
+		 * concurrent readers); smaller ones are scanned. Keys from the
+		 * KeyTable the object was parsed with match by pointer first.
+		 */
+		Value* findMember(const char *key, size_t len) const;
+		Value* findMember(const char *key) const { return findMember(key, strlen(key)); }
+		Value* findMember(const std::string &key) const { return findMember(key.data(), key.size()); }
+		Value& operator[](const char *key) const
+		{
+			Value *v = findMember(key); assert(v != nullptr); return *v;
+		}
+		Value& operator[](const std::string &key) const
+		{
+			Value *v = findMember(key); assert(v != nullptr); return *v;
+		}
+
+		/*
+		 * Building trees in code: containers keep a capacity and grow
+		 * geometrically, so appends are amortized O(1). Parsed containers
+		 * start out exactly full. Values inside a Document cannot be built on.
+		 */
+		void setArray(size_t capacity = 0);
+		size_t getArrayCapacity() const;
+		/* each returns the element where v now lives */
+		Value& pushBack(Value &&v);
+		Value& insert(size_t index, Value &&v);
+		void popBack();
+		void erase(size_t index, size_t count = 1);
+		void setObject(size_t capacity = 0);
+		size_t getObjectCapacity() const;
+		/* appends without looking for key, which is copied; returns the member's value */
+		Value& addMember(const char *key, size_t len, Value &&v);
+		Value& addMember(const char *key, Value &&v) { return addMember(key, strlen(key), std::move(v)); }
+		Value& addMember(const std::string &key, Value &&v) { return addMember(key.data(), key.size(), std::move(v)); }
+		/* the first member named key, keeping the others in order; false if there is none */
+		bool removeMember(const char *key, size_t len);
+		bool removeMember(const char *key) { return removeMember(key, strlen(key)); }
+		bool removeMember(const std::string &key) { return removeMember(key.data(), key.size()); }
+		/* room for capacity elements or members of an array or object */
+		void reserve(size_t capacity);
 
 		std::string stringify() const;
+		/* one element or member per line, "key": value */
+		std::string stringify(const PrettyFormat &) const;
+		/*
+		 * Straight to a sink through a buffer of about bufferSize bytes,
+		 * written out whenever it fills, so memory use does not grow with
+		 * the output.
+		 */
+		StringifyResult stringifyTo(OutputSink &, size_t bufferSize = AJ_STRINGIFY_BUFFER_SIZE) const;
+		StringifyResult stringifyTo(OutputSink &, const PrettyFormat &, size_t bufferSize = AJ_STRINGIFY_BUFFER_SIZE) const;
+		StringifyResult stringifyTo(int fd) const;
+		StringifyResult stringifyTo(FILE *) const;
 	private:
-		ValueType m_type = VALUE_TYPE_NULL;
+		enum {
+			VALUE_FLAG_ARENA = 1,		/* storage belongs to a Document's arena */
+			VALUE_FLAG_BORROWED = 2,	/* string chars (or object keys) point into an in-situ buffer or a KeyTable */
+			VALUE_FLAG_INLINE = 4,		/* AJ_COMPACT_VALUE: string chars are stored in the value itself */
+			VALUE_FLAG_CAPACITY = 8		/* elements or members follow a header holding their capacity */
+		};
+
+#ifdef AJ_COMPACT_VALUE
+		typedef uint32_t Size;
+		/*
+		 * An inline string takes the first INLINE_MAX + 1 bytes: the chars, a
+		 * terminator, and in the last byte INLINE_MAX - length, which is the
+		 * terminator itself when the string is full.
+		 */
+		enum { INLINE_MAX = 13 };
+		/* 4-byte packing lets a pointer and a 32-bit length share 12 bytes */
+#pragma pack(push, 4)
 		union {
 			double m_n;
-			struct { char *s; size_t len; } m_s;
-			struct { Value *e; size_t size; } m_a;
-			struct { Member *m; size_t size; } m_o;
+			int64_t m_i;
+			uint64_t m_u;
+			struct { char *s; Size len; } m_s;
+			struct { Value *e; Size size; } m_a;
+			struct { Member *m; Size size; } m_o;
 		};
+#pragma pack(pop)
+		char m_inlineTail[2];	/* only ever touched as part of an inline string */
+		unsigned char m_flags = 0;
+		unsigned char m_type = VALUE_TYPE_NULL;
 
-		ParseResult parseValue();
-		void parseWhitespace();
-		ParseResult parseLiteral(const char*, ValueType);
-		ParseResult parseNumber();
-		ParseResult parseStringRaw(char *&, size_t &);
-		ParseResult parseString();
-		ParseResult parseArray();
-		ParseResult parseObject();
+		char* inlineChars() const { return reinterpret_cast<char *>(const_cast<Value *>(this)); }
+		void setInline(const char *, size_t);
+#else
+		typedef size_t Size;
+		unsigned char m_type = VALUE_TYPE_NULL;
+		unsigned char m_flags = 0;
+		union {
+			double m_n;
+			int64_t m_i;
+			uint64_t m_u;
+			struct { char *s; Size len; } m_s;
+			struct { Value *e; Size size; } m_a;
+			struct { Member *m; Size size; } m_o;
+		};
+#endif
+
+		/* the Handler that builds the tree */
+		struct Builder;
+		/* indentation and key order while pretty-printing */
+		struct Pretty;
 
-		StringifyResult stringifyValue() const;
-		StringifyResult stringifyString(const char *, size_t) const;	
+		ParseResult parse(Context &, const char *, size_t);
+		/* the grammar, reporting to H: Builder for the DOM or a user Handler */
+		template <typename H> static ParseResult parseDocument(Context &, H &, const char *, size_t);
+		template <typename H> static ParseResult parseValue(Context &, H &);
+		static void parseWhitespace(Context &);
+		template <typename H> static ParseResult parseLiteral(Context &, H &, const char*);
+		template <typename H> static ParseResult parseNumber(Context &, H &);
+		static ParseResult parseStringRaw(Context &, char *&, size_t &);
+		static ParseResult parseStringInsitu(Context &, char *&, size_t &);
+		template <typename H> static ParseResult parseString(Context &, H &, bool);
+		template <typename H> static ParseResult parseMemberKey(Context &, H &);
+
+		StringifyResult stringifyValue(Context &) const;
+		StringifyResult stringifyPretty(Context &, Pretty &) const;
+		StringifyResult stringifyTo(OutputSink &, const PrettyFormat *, size_t) const;
+		static StringifyResult stringifyString(Context &, const char *, size_t);
+		static StringifyResult stringifyLongString(Context &, const char *, size_t);
+		static char* escape(char *, const char *, const char *);
 
 		void freeMem();
+		void copyFrom(const Value &);
+		/* moves n values to raw storage at dst, which may overlap; src is left raw, not to be destroyed */
+		static void relocate(Value *dst, Value *src, size_t n);
+		void growArray(size_t capacity);
+		void growObject(size_t capacity);
+		size_t grown() const;
+#ifndef AJ_COMPACT_VALUE
+		void ownKeys();
+#endif
 
-		bool parseHex4(const char*&, unsigned&);
-		void encode_utf8(unsigned u);
+		static bool parseHex4(const char*&, unsigned&);
+		static ParseResult parseEscapedUnicode(const char*&, const char*, unsigned&);
+		static char* encode_utf8(char *, unsigned u);
+		static void encode_utf8(Context &, unsigned u);
 
-		static Context s_c;
-		static char s_table[];
-		static void* contextPush(size_t);
-		static void* contextPop(size_t);
+		static const char s_table[];
 	};
 
+	inline void swap(Value &a, Value &b) noexcept { a.swap(b); }
+
 	struct Member
 	{
+#ifdef AJ_COMPACT_VALUE
+		Value kv;	/* the key as a string value, so short keys are inline too */
+		const char* key() const { return kv.getString(); }
+		size_t keyLength() const { return kv.getStringLength(); }
+#else
 		char *k; size_t klen;
+		const char* key() const { return k; }
+		size_t keyLength() const { return klen; }
+#endif
 		Value v;
 	};
+
+	/*
+	 * Document is a Value whose whole tree (nodes, strings and keys) is
+	 * allocated from its own Arena, so parsing does few large mallocs and
+	 * destroying or re-parsing it frees chunks instead of walking the tree.
+	 * Values inside a Document must not be given new contents with the
+	 * setters, assignment or swap: their old storage belongs to the arena.
+	 */
+	class Document : public Value {
+		friend class Parser;
+	public:
+		explicit Document(size_t chunkSize = AJ_ARENA_CHUNK_SIZE) : m_arena(chunkSize) {}
+		Document(const Document&) = delete;
+		Document& operator=(const Document&) = delete;
+
+		ParseResult parse(const char *json) { return parse(json, strlen(json)); }
+		ParseResult parse(const char *, size_t, unsigned flags = PARSE_FLAG_NONE);
+		ParseResult parse(const std::string &json) { return parse(json.data(), json.size()); }
+#if __cplusplus >= 201703L
+		ParseResult parse(std::string_view json) { return parse(json.data(), json.size()); }
+#endif
+		ParseResult parseInsitu(char *json) { return parseInsitu(json, strlen(json)); }
+		ParseResult parseInsitu(char *, size_t, unsigned flags = PARSE_FLAG_NONE);
+		ParseResult parseFile(const char *path);
+		/*
+		 * zero-copy: parses in situ on a private mapping of the file, which the
+		 * Document keeps until it is re-parsed or destroyed
+		 */
+		ParseResult parseFileInsitu(const char *path);
+		const Arena& arena() const { return m_arena; }
+		/*
+		 * intern keys in a table of the Document's own, emptied on every
+		 * parse; it takes precedence over a Parser's KeyTable
+		 */
+		void setInternKeys(bool on) { m_internKeys = on; }
+		const KeyTable& keys() const { return m_keys; }
+	private:
+		Arena m_arena;
+		MappedFile m_file;	/* what the strings point into after parseFileInsitu() */
+		KeyTable m_keys;
+		bool m_internKeys = false;
+
+		void reset();
+		ParseResult parse(Context &, const char *, size_t);
+	};
+
+	struct ParserStats {
+		size_t documents = 0;
+		size_t reallocs = 0;		/* scratch stack reallocs actually done */
+		size_t reallocsAvoided = 0;	/* reallocs a fresh stack per document would have done on top */
+		size_t highWater = 0;		/* largest scratch stack usage of any document, in bytes */
+		size_t shrinks = 0;
+	};
+
+	/*
+	 * Parser keeps its scratch stack warm between documents, so parsing a
+	 * stream of messages does not malloc/realloc the stack for every one.
+	 * After each document the stack is shrunk back to maxRetained bytes if it
+	 * grew beyond that. A Parser is not thread-safe; use one per thread.
+	 */
+	class Parser {
+	public:
+		explicit Parser(size_t reserve = AJ_PARSE_STACK_INIT_SIZE, size_t maxRetained = SIZE_MAX);
+		Parser(const Parser&) = delete;
+		Parser& operator=(const Parser&) = delete;
+
+		ParseResult parse(Value &v, const char *json) { return parse(v, json, strlen(json)); }
+		ParseResult parse(Value &, const char *, size_t, unsigned flags = PARSE_FLAG_NONE);
+		ParseResult parse(Document &d, const char *json) { return parse(d, json, strlen(json)); }
+		ParseResult parse(Document &, const char *, size_t, unsigned flags = PARSE_FLAG_NONE);
+		ParseResult parseInsitu(Value &v, char *json) { return parseInsitu(v, json, strlen(json)); }
+		ParseResult parseInsitu(Value &, char *, size_t, unsigned flags = PARSE_FLAG_NONE);
+		ParseResult parseInsitu(Document &d, char *json) { return parseInsitu(d, json, strlen(json)); }
+		ParseResult parseInsitu(Document &, char *, size_t, unsigned flags = PARSE_FLAG_NONE);
+		ParseResult parse(Handler &h, const char *json) { return parse(h, json, strlen(json)); }
+		ParseResult parse(Handler &, const char *, size_t, unsigned flags = PARSE_FLAG_NONE);
+		ParseResult parseInsitu(Handler &h, char *json) { return parseInsitu(h, json, strlen(json)); }
+		ParseResult parseInsitu(Handler &, char *, size_t, unsigned flags = PARSE_FLAG_NONE);
+
+		void setMaxRetained(size_t maxRetained) { m_maxRetained = maxRetained; }
+		/* containers open at once before PARSE_DEPTH_EXCEEDED, AJ_PARSE_MAX_DEPTH by default */
+		void setMaxDepth(size_t maxDepth) { m_c.maxDepth = maxDepth; }
+		/* intern object keys of every tree parsed from now on, null to stop; see KeyTable */
+		void setKeyTable(KeyTable *keys) { m_c.keys = keys; }
+		size_t capacity() const { return m_c.size; }
+		const ParserStats& stats() const { return m_stats; }
+		void release();
+	private:
+		Context m_c;
+		size_t m_maxRetained;
+		ParserStats m_stats;
+
+		ParseResult record(ParseResult, size_t);
+		static size_t coldGrows(size_t);
+	};
+
+	/*
+	 * Resumable parser for input that arrives in pieces: feed() chunks split
+	 * anywhere (inside strings, escapes and numbers too), then finish() once
+	 * the input ends. Events reach the Handler as soon as each one is
+	 * complete. Only the unfinished token and one small record per open
+	 * container are kept, so memory follows nesting depth and token size,
+	 * not document size. After an error, feed() keeps returning it until
+	 * finish() or reset(); finish() also makes the parser ready for the
+	 * next document.
+	 */
+	class PushParser {
+	public:
+		explicit PushParser(Handler &h) : m_h(h) {}
+		PushParser(const PushParser&) = delete;
+		PushParser& operator=(const PushParser&) = delete;
+
+		ParseResult feed(const char *, size_t);
+		ParseResult feed(const std::string &s) { return feed(s.data(), s.size()); }
+		ParseResult finish();
+		void reset();
+		/* containers open at once before PARSE_DEPTH_EXCEEDED, AJ_PARSE_MAX_DEPTH by default */
+		void setMaxDepth(size_t maxDepth) { m_c.maxDepth = maxDepth; }
+
+		size_t depth() const { return m_depth; }
+	private:
+		enum State {
+			STATE_VALUE,
+			STATE_ARRAY_FIRST,	/* just after '[' */
+			STATE_OBJECT_FIRST,	/* just after '{' */
+			STATE_KEY,
+			STATE_COLON,
+			STATE_AFTER_VALUE,
+			STATE_DONE,
+			/* inside a token, from here on */
+			STATE_STRING,
+			STATE_KEY_STRING,
+			STATE_NUMBER,
+			STATE_LITERAL
+		};
+		struct Level {
+			size_t count;
+			char kind;	/* '[' or '{' */
+		};
+
+		Handler &m_h;
+		Context m_c;		/* Levels, plus the usual string and number scratch above them */
+		std::string m_token;	/* the unfinished token, once it crosses a chunk boundary */
+		State m_state = STATE_VALUE;
+		bool m_escape = false;	/* the string token so far ends in an unpaired '\\' */
+		size_t m_depth = 0;
+		size_t m_fed = 0;	/* bytes before the current chunk, for ParseError offsets */
+		size_t m_tokenAt = 0;	/* where the current token starts in the stream */
+		size_t m_errorAt = 0;	/* where the grammar rejected a token, once complete() fails */
+		ParseResult m_result = PARSE_OK;
+
+		const char* value(const char *);
+		const char* token(const char *, const char *);
+		void complete(const char *, const char *);
+		const char* close(const char *);
+		void endValue();
+		ParseResult afterValueError();
+		Level& top() { return reinterpret_cast<Level *>(m_c.stack + m_c.top)[-1]; }
+	};
+
+	struct NdjsonStats {
+		size_t lines = 0;	/* blank ones included */
+		size_t records = 0;	/* lines holding something, parsed or not */
+		size_t errors = 0;
+	};
+
+	/*
+	 * Reads newline-delimited JSON (JSON Lines): one value per line, blank
+	 * lines skipped. The input is cut into batches of whole lines, about
+	 * batchSize bytes each, which a pool of worker threads parses. The
+	 * callback gets each record's 1-based line number, its parse result and
+	 * the value (null when the line did not parse), which only lives for the
+	 * call. Ordered mode makes the calls one at a time in input order;
+	 * unordered mode makes them from the workers as lines finish, so they
+	 * run concurrently and out of order, without waiting on each other.
+	 */
+	class NdjsonReader {
+	public:
+		typedef std::function<void(size_t line, ParseResult, Value &)> Callback;
+
+		explicit NdjsonReader(unsigned threads = 0, size_t batchSize = AJ_NDJSON_BATCH_SIZE);
+
+		void setOrdered(bool ordered) { m_ordered = ordered; }
+		unsigned threads() const { return m_threads; }
+
+		NdjsonStats read(const char *, size_t, const Callback &);
+		NdjsonStats read(FILE *, const Callback &);
+	private:
+		unsigned m_threads;
+		size_t m_batchSize;
+		bool m_ordered = true;
+	};
+
+	/*
+	 * Read-only flat form of a document for query-heavy use. parse() runs in
+	 * two stages: a SIMD pass indexes the structural characters of the
+	 * input (brackets, braces, colons and commas outside strings, opening
+	 * quotes and the first byte of every other scalar), then one pass over
+	 * that index writes a tape of 64-bit words, an 8-bit tag and a 56-bit
+	 * payload each. A container's first word holds the distance to its last,
+	 * which holds its size, so a subtree is skipped in O(1); a number is
+	 * followed by a word with its bits; a string points into one side buffer
+	 * holding a 32-bit length, the chars and a terminator. Cursors are valid
+	 * until the next parse(). Input is limited to 4 GB.
+	 */
+	class Tape {
+		enum Tag {
+			TAG_END = 0,	/* after the root */
+			TAG_NULL = 'n', TAG_TRUE = 't', TAG_FALSE = 'f',
+			TAG_DOUBLE = 'd', TAG_INT64 = 'l', TAG_UINT64 = 'u',
+			TAG_STRING = '"',
+			TAG_LAZY_STRING = 's', TAG_LAZY_NUMBER = '#',	/* parseLazy: offsets into the input */
+			TAG_ARRAY = '[', TAG_ARRAY_END = ']',
+			TAG_OBJECT = '{', TAG_OBJECT_END = '}'
+		};
+		static const uint64_t PAYLOAD = (uint64_t(1) << 56) - 1;
+	public:
+		/* a value on the tape; a default-constructed or exhausted one is null */
+		class Cursor {
+		public:
+			Cursor() = default;
+			explicit operator bool() const { return m_w != nullptr; }
+
+			ValueType type() const
+			{
+				switch (tag()) {
+				case TAG_FALSE: return VALUE_TYPE_FALSE;
+				case TAG_TRUE: return VALUE_TYPE_TRUE;
+				case TAG_DOUBLE: return VALUE_TYPE_NUMBER;
+				case TAG_INT64: return VALUE_TYPE_INT64;
+				case TAG_UINT64: return VALUE_TYPE_UINT64;
+				case TAG_STRING: case TAG_LAZY_STRING: return VALUE_TYPE_STRING;
+				case TAG_LAZY_NUMBER: decode(); return type();
+				case TAG_ARRAY: return VALUE_TYPE_ARRAY;
+				case TAG_OBJECT: return VALUE_TYPE_OBJECT;
+				default: return VALUE_TYPE_NULL;
+				}
+			}
+			bool getBool() const
+			{
+				assert(tag() == TAG_TRUE || tag() == TAG_FALSE); return tag() == TAG_TRUE;
+			}
+			bool isNumber() const
+			{
+				return tag() == TAG_DOUBLE || tag() == TAG_INT64 || tag() == TAG_UINT64 || tag() == TAG_LAZY_NUMBER;
+			}
+			/* any number, integers are converted */
+			double getNumber() const
+			{
+				assert(isNumber());
+				decode();
+				double d;
+				if (tag() == TAG_DOUBLE)
+					memcpy(&d, m_w + 1, sizeof(d));
+				else
+					d = tag() == TAG_INT64 ? static_cast<double>(static_cast<int64_t>(m_w[1])) : static_cast<double>(m_w[1]);
+				return d;
+			}
+			int64_t getInt64() const
+			{
+				decode();
+				assert(tag() == TAG_INT64); return static_cast<int64_t>(m_w[1]);
+			}
+			uint64_t getUint64() const
+			{
+				decode();
+				assert(tag() == TAG_UINT64 || (tag() == TAG_INT64 && static_cast<int64_t>(m_w[1]) >= 0));
+				return m_w[1];
+			}
+			const char* getString() const
+			{
+				decode();
+				assert(tag() == TAG_STRING); return m_t->m_strings + (*m_w & PAYLOAD) + sizeof(uint32_t);
+			}
+			size_t getStringLength() const
+			{
+				decode();
+				assert(tag() == TAG_STRING);
+				uint32_t len;
+				memcpy(&len, m_t->m_strings + (*m_w & PAYLOAD), sizeof(len));
+				return len;
+			}
+			size_t getArraySize() const
+			{
+				assert(tag() == TAG_ARRAY); return m_w[*m_w & PAYLOAD] & PAYLOAD;
+			}
+			size_t getObjectSize() const
+			{
+				assert(tag() == TAG_OBJECT); return m_w[*m_w & PAYLOAD] & PAYLOAD;
+			}
+			/* these walk the container, so are O(index) */
+			Cursor getArrayElement(size_t) const;
+			const char* getObjectKey(size_t) const;
+			size_t getObjectKeyLength(size_t) const;
+			Cursor getObjectValue(size_t) const;
+			Cursor findMember(const char *key, size_t len) const;
+			Cursor findMember(const char *key) const { return findMember(key, strlen(key)); }
+			Cursor findMember(const std::string &key) const { return findMember(key.data(), key.size()); }
+
+			/*
+			 * Iteration: first() is a container's first element, or first key
+			 * for an object, whose next() is its value; next() skips this
+			 * value's subtree. Both are null past the end.
+			 */
+			Cursor first() const
+			{
+				assert(tag() == TAG_ARRAY || tag() == TAG_OBJECT);
+				return (*m_w & PAYLOAD) == 1 ? Cursor() : Cursor(m_w + 1, m_t);
+			}
+			Cursor next() const
+			{
+				const uint64_t *w = m_w + (tag() == TAG_ARRAY || tag() == TAG_OBJECT ? (*m_w & PAYLOAD) + 1
+					: isNumber() ? 2 : 1);
+				Tag t = static_cast<Tag>(*w >> 56);
+				return t == TAG_END || t == TAG_ARRAY_END || t == TAG_OBJECT_END ? Cursor() : Cursor(w, m_t);
+			}
+		private:
+			friend class Tape;
+			const uint64_t *m_w = nullptr;
+			const Tape *m_t = nullptr;
+
+			Cursor(const uint64_t *w, const Tape *t) : m_w(w), m_t(t) {}
+			Tag tag() const { return static_cast<Tag>(*m_w >> 56); }
+			void decode() const
+			{
+				if (tag() == TAG_LAZY_STRING || tag() == TAG_LAZY_NUMBER)
+					m_t->resolve(m_w);
+			}
+			bool keyEquals(const char *key, size_t len, bool plain) const;
+		};
+
+		Tape() = default;
+		Tape(const Tape&) = delete;
+		Tape& operator=(const Tape&) = delete;
+		~Tape();
+
+		ParseResult parse(const char *json) { return parse(json, strlen(json)); }
+		ParseResult parse(const char *json, size_t len, unsigned flags = PARSE_FLAG_NONE) { return parse(json, len, flags, false); }
+		ParseResult parse(const std::string &json) { return parse(json.data(), json.size()); }
+#if __cplusplus >= 201703L
+		ParseResult parse(std::string_view json) { return parse(json.data(), json.size()); }
+#endif
+		/*
+		 * On demand: the whole document is validated as by parse(), but
+		 * strings stay escaped and numbers unconverted in the input until a
+		 * getter first reads them, so json must outlive the tape. Reads
+		 * decode into the tape: a lazy tape is not safe for concurrent readers.
+		 */
+		ParseResult parseLazy(const char *json) { return parseLazy(json, strlen(json)); }
+		ParseResult parseLazy(const char *json, size_t len, unsigned flags = PARSE_FLAG_NONE) { return parse(json, len, flags, true); }
+		/* containers open at once before PARSE_DEPTH_EXCEEDED, AJ_PARSE_MAX_DEPTH by default */
+		void setMaxDepth(size_t maxDepth) { m_c.maxDepth = maxDepth; }
+		/* null unless the last parse succeeded */
+		Cursor root() const { return m_ok ? Cursor(m_words, this) : Cursor(); }
+
+		size_t size() const { return m_size; }					/* tape words */
+		size_t structurals() const { return m_structurals; }	/* stage one index entries */
+		size_t stringBytes() const { return m_stringsSize; }	/* decoded so far, for a lazy tape */
+	private:
+		struct Builder;
+
+		ParseResult parse(const char *, size_t, unsigned, bool lazy);
+		void resolve(const uint64_t *) const;
+
+		mutable Context m_c;	/* open containers, and string scratch above them */
+		const char *m_json = nullptr;
+		size_t m_len = 0;
+		uint64_t *m_words = nullptr;
+		size_t m_size = 0, m_wordsCapacity = 0;
+		char *m_strings = nullptr;
+		mutable size_t m_stringsSize = 0;
+		size_t m_stringsCapacity = 0;
+		uint32_t *m_index = nullptr;
+		size_t m_structurals = 0, m_indexCapacity = 0;
+		bool m_ok = false;
+	};
+
+	/* where a Writer's output goes, a chunk at a time */
+	class OutputSink {
+	public:
+		virtual ~OutputSink() {}
+		/* all of it, or false */
+		virtual bool write(const char *, size_t) = 0;
+		/* two pieces in order; sinks that can gather them in one call do */
+		virtual bool writev(const char *a, size_t alen, const char *b, size_t blen) { return write(a, alen) && write(b, blen); }
+	};
+
+	/* a growable buffer */
+	class StringSink : public OutputSink {
+	public:
+		bool write(const char *s, size_t len) override { m_s.append(s, len); return true; }
+		std::string& str() { return m_s; }
+	private:
+		std::string m_s;
+	};
+
+	/* a caller's buffer; writes that do not fit fail and leave it as it was */
+	class FixedSink : public OutputSink {
+	public:
+		FixedSink(char *buf, size_t capacity) : m_buf(buf), m_capacity(capacity) {}
+		bool write(const char *, size_t) override;
+		size_t size() const { return m_size; }
+	private:
+		char *m_buf;
+		size_t m_capacity, m_size = 0;
+	};
+
+	class FileSink : public OutputSink {
+	public:
+		explicit FileSink(FILE *f) : m_f(f) {}
+		bool write(const char *s, size_t len) override { return fwrite(s, 1, len, m_f) == len; }
+	private:
+		FILE *m_f;
+	};
+
+	/* a file descriptor, retrying short writes and EINTR */
+	class FdSink : public OutputSink {
+	public:
+		explicit FdSink(int fd) : m_fd(fd) {}
+		bool write(const char *, size_t) override;
+		bool writev(const char *, size_t, const char *, size_t) override;
+	private:
+		int m_fd;
+	};
+
+	/*
+	 * Writes JSON straight to a sink, without building a tree, in chunks of
+	 * about bufferSize bytes. Calls must make up a single document, which
+	 * is checked with assert; each returns false once the sink has failed.
+	 * Whatever is still buffered goes out on flush() or destruction.
+	 */
+	class Writer {
+	public:
+		explicit Writer(OutputSink &, size_t bufferSize = AJ_WRITER_BUFFER_SIZE);
+		Writer(const Writer&) = delete;
+		Writer& operator=(const Writer&) = delete;
+		~Writer() { flush(); }
+
+		bool null();
+		bool boolean(bool);
+		bool number(double);
+		bool int64(int64_t);
+		bool uint64(uint64_t);
+		bool string(const char *, size_t);
+		bool string(const char *s) { return string(s, strlen(s)); }
+		bool string(const std::string &s) { return string(s.data(), s.size()); }
+		bool startObject();
+		bool key(const char *, size_t);
+		bool key(const char *k) { return key(k, strlen(k)); }
+		bool key(const std::string &k) { return key(k.data(), k.size()); }
+		bool endObject();
+		bool startArray();
+		bool endArray();
+		/* a whole tree, written as stringify() would */
+		bool value(const Value &);
+
+		bool flush();
+		/* the root value has been written */
+		bool complete() const { return m_complete; }
+	private:
+		Context m_c;		/* the buffer */
+		OutputSink &m_sink;
+		size_t m_bufferSize;
+		std::string m_open;	/* '[' or '{' for each open container */
+		bool m_comma = false;	/* a value came before in the current container */
+		bool m_keyed = false;	/* in an object, a key is waiting for its value */
+		bool m_complete = false;
+		bool m_ok = true;
+
+		void beforeValue();
+		bool afterValue();
+		void putString(const char *, size_t);
+	};
 }
 
 #endif /* AJson_H */
@@ -0,0 +1,1063 @@
+#include "AJson.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace AJson;
+
+static double now()
+{
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+/* a mixed document of roughly `records` small objects */
+static std::string makeRecords(size_t records)
+{
+	std::string s = "[";
+	char buf[256];
+	for (size_t i = 0; i < records; ++i) {
+		snprintf(buf, sizeof(buf),
+			"%s{\"id\":%zu,\"name\":\"user-%zu\",\"active\":%s,\"score\":%.3f,"
+			"\"tags\":[\"a\",\"bb\",\"ccc\"],\"geo\":{\"lat\":%.6f,\"lon\":%.6f}}",
+			i ? "," : "", i, i, i % 3 ? "true" : "false", i * 0.37,
+			(i % 180) - 90.0 + 0.123456, (i % 360) - 180.0 + 0.654321);
+		s += buf;
+	}
+	s += "]";
+	return s;
+}
+
+/* log-like records where strings dominate the payload */
+static std::string makeLogLines(size_t records)
+{
+	std::string s = "[";
+	char buf[512];
+	for (size_t i = 0; i < records; ++i) {
+		snprintf(buf, sizeof(buf),
+			"%s{\"ts\":\"2024-05-%02zuT12:%02zu:%02zu.%03zuZ\",\"level\":\"%s\",\"host\":\"ingest-%03zu.example.net\","
+			"\"msg\":\"request %zu served from cache in the eu-west region\\twith status ok\",\"path\":\"/api/v2/items/%zu\"}",
+			i ? "," : "", 1 + i % 28, i % 60, (i * 7) % 60, i % 1000, i % 5 ? "info" : "warn", i % 200, i, i);
+		s += buf;
+	}
+	s += "]";
+	return s;
+}
+
+/* the same kind of records pretty-printed with deep indentation */
+static std::string makeIndented(size_t records)
+{
+	std::string s = "{\n    \"records\": [\n";
+	char buf[512];
+	for (size_t i = 0; i < records; ++i) {
+		snprintf(buf, sizeof(buf),
+			"        {\n"
+			"            \"id\": %zu,\n"
+			"            \"name\": \"user-%zu\",\n"
+			"            \"tags\": [\n"
+			"                \"a\",\n"
+			"                \"bb\"\n"
+			"            ],\n"
+			"            \"geo\": {\n"
+			"                \"lat\": %.2f,\n"
+			"                \"lon\": %.2f\n"
+			"            }\n"
+			"        }%s\n",
+			i, i, (i % 180) - 90.0, (i % 360) - 180.0, i + 1 < records ? "," : "");
+		s += buf;
+	}
+	s += "    ]\n}\n";
+	return s;
+}
+
+/* telemetry-like numeric arrays: counters, short decimals and full-precision doubles */
+static std::string makeNumbers(size_t count)
+{
+	std::string s = "[";
+	char buf[64];
+	unsigned long long x = 88172645463325252ull;
+	for (size_t i = 0; i < count; ++i) {
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+		switch (i % 3) {
+		case 0: snprintf(buf, sizeof(buf), "%s%llu", i ? "," : "", x % 1000000000); break;
+		case 1: snprintf(buf, sizeof(buf), "%s%.2f", i ? "," : "", (x % 100000) / 7.0); break;
+		default: snprintf(buf, sizeof(buf), "%s%.17g", i ? "," : "", (x >> 11) * (1.0 / 9007199254740992.0) * 1e6); break;
+		}
+		s += buf;
+	}
+	s += "]";
+	return s;
+}
+
+/* parse throughput with 1..N threads, each parsing its own copy of the document */
+static void benchThreads()
+{
+	const std::string json = makeRecords(2000);
+	const int iterations = 200;
+	unsigned maxThreads = std::thread::hardware_concurrency();
+	if (maxThreads == 0)
+		maxThreads = 1;
+
+	printf("threads: %zu bytes x %d parses per thread\n", json.size(), iterations);
+	std::vector<unsigned> counts;
+	for (unsigned n = 1; n < maxThreads; n *= 2)
+		counts.push_back(n);
+	counts.push_back(maxThreads);
+
+	double base = 0;
+	for (unsigned n : counts) {
+		std::vector<std::thread> workers;
+		double t0 = now();
+		for (unsigned t = 0; t < n; ++t) {
+			workers.emplace_back([&json, iterations] {
+				for (int i = 0; i < iterations; ++i) {
+					Value v;
+					if (v.parse(json.c_str()) != PARSE_OK)
+						abort();
+				}
+			});
+		}
+		for (auto &w : workers)
+			w.join();
+		double mbs = json.size() * iterations * n / (now() - t0) / 1e6;
+		if (n == 1)
+			base = mbs;
+		printf("  %2u thread(s): %8.1f MB/s  x%.2f\n", n, mbs, mbs / base);
+	}
+}
+
+/* many small messages: a fresh scratch stack per parse vs a warm Parser */
+static void benchReuse()
+{
+	std::vector<std::string> msgs;
+	for (size_t i = 0; i < 64; ++i)
+		msgs.push_back(makeRecords(1 + i % 8));
+	const int iterations = 5000;
+	size_t bytes = 0;
+	for (auto &m : msgs)
+		bytes += m.size() * iterations;
+
+	double t0 = now();
+	for (int i = 0; i < iterations; ++i) {
+		for (auto &m : msgs) {
+			Value v;
+			v.parse(m.c_str());
+		}
+	}
+	double cold = now() - t0;
+
+	Parser p;
+	t0 = now();
+	for (int i = 0; i < iterations; ++i) {
+		for (auto &m : msgs) {
+			Value v;
+			p.parse(v, m.c_str());
+		}
+	}
+	double warm = now() - t0;
+
+	printf("reuse: %zu messages, avg %zu bytes\n", msgs.size() * iterations, bytes / msgs.size() / iterations);
+	printf("  Value::parse  %8.1f MB/s\n", bytes / cold / 1e6);
+	printf("  Parser::parse %8.1f MB/s  reallocs %zu, avoided %zu, high water %zu bytes\n", bytes / warm / 1e6,
+		p.stats().reallocs, p.stats().reallocsAvoided, p.stats().highWater);
+}
+
+/* run fn in a child process and return its peak RSS in MB, so modes do not share one high-water mark */
+template <typename F>
+static double peakRssOf(F fn)
+{
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid == 0) {
+		fn();
+		fflush(stdout);
+		_exit(0);
+	}
+	int status;
+	struct rusage ru;
+	wait4(pid, &status, 0, &ru);
+	return ru.ru_maxrss / 1024.0;
+}
+
+/* parse + destroy of a large document: malloc per node vs one Arena per Document */
+static void benchArena()
+{
+	const std::string json = makeRecords(100000);
+	printf("arena: %.1f MB document\n", json.size() / 1e6);
+
+	double rss = peakRssOf([&json] {
+		double t0 = now();
+		Value *v = new Value;
+		v->parse(json.c_str());
+		double t1 = now();
+		delete v;
+		double t2 = now();
+		printf("  malloc   parse %7.1f ms  destroy %6.2f ms", (t1 - t0) * 1e3, (t2 - t1) * 1e3);
+	});
+	printf("  peak RSS %6.1f MB\n", rss);
+
+	rss = peakRssOf([&json] {
+		double t0 = now();
+		Document *d = new Document;
+		d->parse(json.c_str());
+		double t1 = now();
+		delete d;
+		double t2 = now();
+		printf("  Document parse %7.1f ms  destroy %6.2f ms", (t1 - t0) * 1e3, (t2 - t1) * 1e3);
+	});
+	printf("  peak RSS %6.1f MB\n", rss);
+}
+
+/* copying parse vs in-situ parse on a string-heavy corpus */
+static void benchInsitu()
+{
+	const std::string json = makeLogLines(20000);
+	const int iterations = 20;
+	std::vector<char> buf(json.size() + 1);
+	printf("insitu: %.1f MB string-heavy document\n", json.size() / 1e6);
+
+	double t0 = now();
+	for (int i = 0; i < iterations; ++i) {
+		Value v;
+		v.parse(json.c_str());
+	}
+	printf("  Value::parse             %8.1f MB/s\n", json.size() * iterations / (now() - t0) / 1e6);
+
+	t0 = now();
+	for (int i = 0; i < iterations; ++i) {
+		memcpy(buf.data(), json.c_str(), buf.size());
+		Value v;
+		v.parseInsitu(buf.data());
+	}
+	printf("  Value::parseInsitu       %8.1f MB/s (including buffer copy)\n", json.size() * iterations / (now() - t0) / 1e6);
+
+	Document d;
+	t0 = now();
+	for (int i = 0; i < iterations; ++i) {
+		memcpy(buf.data(), json.c_str(), buf.size());
+		d.parseInsitu(buf.data());
+	}
+	printf("  Document::parseInsitu    %8.1f MB/s (including buffer copy)\n", json.size() * iterations / (now() - t0) / 1e6);
+}
+
+/* whitespace and string scanners at every SIMD level the CPU supports */
+static void benchSimd()
+{
+	static const char *names[] = { "scalar", "SSE2", "AVX2" };
+	const std::string corpora[] = { makeIndented(20000), makeLogLines(20000) };
+	const char *corpusNames[] = { "indented", "strings" };
+	const int iterations = 20;
+	SimdLevel best = simdLevel();
+
+	printf("simd:\n");
+	for (int k = 0; k < 2; ++k) {
+		const std::string &json = corpora[k];
+		std::vector<char> buf(json.size() + AJ_PARSE_PADDING, ' ');
+		memcpy(buf.data(), json.data(), json.size());
+		for (int level = SIMD_NONE; level <= best; ++level) {
+			setSimdLevel(static_cast<SimdLevel>(level));
+			Document d;
+			double t0 = now();
+			for (int i = 0; i < iterations; ++i)
+				d.parse(json.data(), json.size());
+			double plain = now() - t0;
+			t0 = now();
+			for (int i = 0; i < iterations; ++i)
+				d.parse(buf.data(), json.size(), PARSE_FLAG_PADDED);
+			double padded = now() - t0;
+			printf("  %-8s %5.1f MB  %-6s %8.1f MB/s  padded %8.1f MB/s\n", corpusNames[k], json.size() / 1e6, names[level],
+				json.size() * iterations / plain / 1e6, json.size() * iterations / padded / 1e6);
+		}
+	}
+	setSimdLevel(best);
+}
+
+static void benchNumbers()
+{
+	const std::string json = makeNumbers(1000000);
+	const int iterations = 10;
+	Document d;
+	double t0 = now();
+	for (int i = 0; i < iterations; ++i)
+		d.parse(json.data(), json.size());
+	double t = now() - t0;
+	printf("numbers: %.1f MB, %zu numbers: %8.1f MB/s  %6.1f ns/number\n", json.size() / 1e6, d.getArraySize(),
+		json.size() * iterations / t / 1e6, t / iterations / d.getArraySize() * 1e9);
+}
+
+/* parse + stringify of ids and nanosecond timestamps, the integer-heavy round trip */
+static void benchIntegers()
+{
+	std::string json = "[";
+	char buf[64];
+	unsigned long long x = 88172645463325252ull;
+	for (size_t i = 0; i < 1000000; ++i) {
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+		snprintf(buf, sizeof(buf), "%s%llu", i ? "," : "", i % 2 ? x : 1700000000000000000ull + x % 1000000000000ull);
+		json += buf;
+	}
+	json += "]";
+	const int iterations = 10;
+	Document d;
+	std::string out;
+	double t0 = now();
+	for (int i = 0; i < iterations; ++i)
+		d.parse(json.data(), json.size());
+	double parse = now() - t0;
+	t0 = now();
+	for (int i = 0; i < iterations; ++i)
+		out = d.stringify();
+	double stringify = now() - t0;
+	printf("integers: %.1f MB  parse %8.1f MB/s  stringify %8.1f MB/s  round trip %s\n", json.size() / 1e6,
+		json.size() * iterations / parse / 1e6, out.size() * iterations / stringify / 1e6, out == json ? "exact" : "LOSSY");
+}
+
+/* stringify of random doubles against sprintf("%.17g"), checking every value reads back exactly */
+static void benchDoubles()
+{
+	const size_t count = 1000000;
+	std::string json = "[";
+	char buf[64];
+	unsigned long long x = 88172645463325252ull;
+	for (size_t i = 0; i < count; ++i) {
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+		double v = i % 2 ? (x >> 11) * (1.0 / 9007199254740992.0) * 1e6 : (x % 100000) / 100.0;
+		snprintf(buf, sizeof(buf), "%s%.17g", i ? "," : "", v);
+		json += buf;
+	}
+	json += "]";
+	Document d;
+	d.parse(json.data(), json.size());
+
+	const int iterations = 10;
+	double t0 = now();
+	for (int i = 0; i < iterations; ++i)
+		for (size_t j = 0; j < count; ++j)
+			snprintf(buf, sizeof(buf), "%.17g", d.getArrayElement(j)->getNumber());
+	double tsprintf = now() - t0;
+
+	std::string out;
+	t0 = now();
+	for (int i = 0; i < iterations; ++i)
+		out = d.stringify();
+	double tshortest = now() - t0;
+
+	Document back;
+	bool exact = back.parse(out.data(), out.size()) == PARSE_OK && back.getArraySize() == count;
+	for (size_t j = 0; exact && j < count; ++j) {
+		double a = d.getArrayElement(j)->getNumber(), b = back.getArrayElement(j)->getNumber();
+		exact = memcmp(&a, &b, sizeof(a)) == 0;
+	}
+	printf("doubles: %zu values\n", count);
+	printf("  %%.17g     %6.1f ns/number  %5.1f MB\n", tsprintf / iterations / count * 1e9, json.size() / 1e6);
+	printf("  stringify %6.1f ns/number  %5.1f MB  round trip %s\n", tshortest / iterations / count * 1e9,
+		out.size() / 1e6, exact ? "exact" : "LOSSY");
+}
+
+/* pick two fields out of every record: SAX handler vs building the tree */
+static void benchSax()
+{
+	const std::string json = makeRecords(100000);
+	const int iterations = 10;
+
+	struct Filter : Handler {
+		bool wantScore = false;
+		size_t depth = 0, hits = 0;
+		double score = 0;
+		bool onStartObject() override { ++depth; return true; }
+		bool onEndObject(size_t) override { --depth; return true; }
+		bool onKey(const char *k, size_t len) override
+		{
+			wantScore = depth == 1 && len == 5 && memcmp(k, "score", 5) == 0;
+			return true;
+		}
+		bool onNumber(double d) override
+		{
+			if (wantScore) {
+				score += d;
+				++hits;
+				wantScore = false;
+			}
+			return true;
+		}
+	};
+
+	printf("sax: %.1f MB, %d passes, sum one field per record\n", json.size() / 1e6, iterations);
+	double rss = peakRssOf([&json] {
+		double t0 = now();
+		double score = 0;
+		for (int i = 0; i < iterations; ++i) {
+			Document d;
+			d.parse(json.data(), json.size());
+			score = 0;
+			for (size_t j = 0; j < d.getArraySize(); ++j) {
+				const Value *r = d.getArrayElement(j);
+				for (size_t k = 0; k < r->getObjectSize(); ++k)
+					if (strcmp(r->getObjectKey(k), "score") == 0)
+						score += r->getObjectValue(k)->getNumber();
+			}
+		}
+		printf("  Document %8.1f MB/s  sum %.2f", json.size() * iterations / (now() - t0) / 1e6, score);
+	});
+	printf("  peak RSS %6.1f MB\n", rss);
+	rss = peakRssOf([&json] {
+		double t0 = now();
+		Filter f;
+		for (int i = 0; i < iterations; ++i) {
+			f = Filter();
+			parse(f, json.data(), json.size());
+		}
+		printf("  Handler  %8.1f MB/s  sum %.2f", json.size() * iterations / (now() - t0) / 1e6, f.score);
+	});
+	printf("  peak RSS %6.1f MB\n", rss);
+}
+
+/* chunked input through PushParser: one-shot parse vs 4 KB feeds, then a stream never held in memory */
+static void benchPush()
+{
+	const std::string json = makeRecords(100000);
+	const int iterations = 10;
+	const size_t chunk = 4096;
+	Handler none;
+
+	printf("push: %.1f MB document\n", json.size() / 1e6);
+	double t0 = now();
+	for (int i = 0; i < iterations; ++i)
+		parse(none, json.data(), json.size());
+	printf("  parse(Handler)     %8.1f MB/s\n", json.size() * iterations / (now() - t0) / 1e6);
+
+	PushParser p(none);
+	t0 = now();
+	for (int i = 0; i < iterations; ++i) {
+		for (size_t j = 0; j < json.size(); j += chunk)
+			p.feed(json.data() + j, std::min(chunk, json.size() - j));
+		p.finish();
+	}
+	printf("  PushParser 4 KB    %8.1f MB/s\n", json.size() * iterations / (now() - t0) / 1e6);
+
+	double rss = peakRssOf([] {
+		Handler h;
+		PushParser p(h);
+		const std::string piece = makeRecords(1000);
+		size_t bytes = 0;
+		double t0 = now();
+		p.feed("[", 1);
+		for (int i = 0; i < 2000; ++i) {
+			if (i)
+				p.feed(",", 1);
+			/* the inner records of each piece, in odd-sized chunks */
+			for (size_t j = 1; j < piece.size() - 1; j += 1000)
+				p.feed(piece.data() + j, std::min<size_t>(1000, piece.size() - 1 - j));
+			bytes += piece.size() - 1;
+		}
+		p.feed("]", 1);
+		ParseResult res = p.finish();
+		printf("  stream %7.1f MB  %8.1f MB/s  %s", bytes / 1e6, bytes / (now() - t0) / 1e6, res == PARSE_OK ? "ok" : "error");
+	});
+	printf("  peak RSS %6.1f MB\n", rss);
+}
+
+/* JSON Lines through NdjsonReader: records/s with 1..N worker threads, both delivery modes */
+static void benchNdjson()
+{
+	std::string data;
+	char buf[256];
+	const size_t records = 500000;
+	for (size_t i = 0; i < records; ++i) {
+		snprintf(buf, sizeof(buf),
+			"{\"id\":%zu,\"name\":\"user-%zu\",\"active\":%s,\"score\":%.3f,\"tags\":[\"a\",\"bb\"],\"geo\":{\"lat\":%.6f}}\n",
+			i, i, i % 3 ? "true" : "false", i * 0.37, (i % 180) - 90.0 + 0.123456);
+		data += buf;
+	}
+	unsigned maxThreads = std::thread::hardware_concurrency();
+	if (maxThreads == 0)
+		maxThreads = 1;
+	std::vector<unsigned> counts;
+	for (unsigned n = 1; n < maxThreads; n *= 2)
+		counts.push_back(n);
+	counts.push_back(maxThreads);
+
+	printf("ndjson: %zu records, %.1f MB\n", records, data.size() / 1e6);
+	for (int ordered = 1; ordered >= 0; --ordered) {
+		double base = 0;
+		for (unsigned n : counts) {
+			NdjsonReader r(n);
+			r.setOrdered(ordered != 0);
+			double t0 = now();
+			NdjsonStats stats = r.read(data.data(), data.size(), [](size_t, ParseResult, Value &) {});
+			double rate = stats.records / (now() - t0);
+			if (n == 1)
+				base = rate;
+			printf("  %-9s %2u thread(s): %6.2f M records/s  x%.2f%s\n", ordered ? "ordered" : "unordered", n, rate / 1e6,
+				rate / base, stats.errors ? "  ERRORS" : "");
+		}
+	}
+}
+
+/* a large snapshot from disk: fread + parse vs parsing the mapping vs in situ on a private mapping */
+static void benchFile()
+{
+	const char *path = "/tmp/ajson_bench_file.json";
+	{
+		const std::string json = makeLogLines(500000);
+		FILE *f = fopen(path, "wb");
+		fwrite(json.data(), 1, json.size(), f);
+		fclose(f);
+	}
+	printf("file: %s\n", path);
+
+	double rss = peakRssOf([path] {
+		double t0 = now();
+		FILE *f = fopen(path, "rb");
+		fseek(f, 0, SEEK_END);
+		std::vector<char> buf(ftell(f));
+		fseek(f, 0, SEEK_SET);
+		size_t n = fread(buf.data(), 1, buf.size(), f);
+		fclose(f);
+		Document d;
+		d.parse(buf.data(), n);
+		printf("  fread + parse             %7.1f ms  %.1f MB", (now() - t0) * 1e3, n / 1e6);
+	});
+	printf("  peak RSS %6.1f MB\n", rss);
+	rss = peakRssOf([path] {
+		double t0 = now();
+		Document d;
+		d.parseFile(path);
+		printf("  Document::parseFile       %7.1f ms", (now() - t0) * 1e3);
+	});
+	printf("  peak RSS %6.1f MB\n", rss);
+	rss = peakRssOf([path] {
+		double t0 = now();
+		Document d;
+		d.parseFileInsitu(path);
+		printf("  Document::parseFileInsitu %7.1f ms", (now() - t0) * 1e3);
+	});
+	printf("  peak RSS %6.1f MB\n", rss);
+	remove(path);
+}
+
+/* key lookup against object width: a linear scan of the members vs findMember */
+static void benchMembers()
+{
+	for (size_t width : { 4, 16, 64, 256, 1024 }) {
+		std::string json = "{";
+		std::vector<std::string> keys;
+		for (size_t i = 0; i < width; ++i) {
+			keys.push_back("field_" + std::to_string(i * 7919));
+			json += (i ? ",\"" : "\"") + keys.back() + "\":" + std::to_string(i);
+		}
+		json += "}";
+		Value v;
+		v.parse(json);
+		const size_t lookups = 4000000;
+		double sum = 0, t0 = now();
+		for (size_t n = 0; n < lookups; ++n) {
+			const std::string &k = keys[n % width];
+			for (size_t i = 0; i < v.getObjectSize(); ++i)
+				if (v.getObjectKeyLength(i) == k.size() && memcmp(v.getObjectKey(i), k.data(), k.size()) == 0) {
+					sum += v.getObjectValue(i)->getNumber();
+					break;
+				}
+		}
+		double scan = now() - t0;
+		t0 = now();
+		for (size_t n = 0; n < lookups; ++n)
+			sum += v.findMember(keys[n % width])->getNumber();
+		double found = now() - t0;
+		printf("  %4zu members: scan %6.1f ns  findMember %5.1f ns  x%.1f%s\n", width, scan / lookups * 1e9,
+			found / lookups * 1e9, scan / found, sum < 0 ? "!" : "");
+	}
+}
+
+/* a large array of records with the same keys: keys copied per object vs interned */
+static void benchKeys()
+{
+	const std::string json = makeLogLines(200000);
+	const int iterations = 5;
+	printf("keys: %.1f MB, %d records of 5 keys\n", json.size() / 1e6, 200000);
+	for (int intern = 0; intern < 2; ++intern) {
+		KeyTable keys;
+		Parser p;
+		p.setKeyTable(intern ? &keys : nullptr);
+		double parse = 0, teardown = 0, lookup = 0, sum = 0;
+		for (int i = 0; i < iterations; ++i) {
+			Value *v = new Value;
+			double t0 = now();
+			p.parse(*v, json.data(), json.size());
+			parse += now() - t0;
+			t0 = now();
+			for (size_t r = 0; r < v->getArraySize(); ++r)
+				sum += v->getArrayElement(r)->findMember("path")->getStringLength();
+			lookup += now() - t0;
+			t0 = now();
+			delete v;
+			teardown += now() - t0;
+		}
+		printf("  %-8s parse %6.1f ms  lookup %5.1f ms  teardown %5.1f ms%s\n", intern ? "interned" : "copied",
+			parse / iterations * 1e3, lookup / iterations * 1e3, teardown / iterations * 1e3, sum < 0 ? "!" : "");
+		if (intern)
+			printf("  %zu distinct keys in %zu bytes, %.1f MB of key copies saved\n", keys.size(), keys.bytes(),
+				keys.stats().bytesSaved / 1e6);
+	}
+}
+
+static size_t countNodes(const Value &v)
+{
+	size_t n = 1;
+	if (v.type() == VALUE_TYPE_ARRAY)
+		for (size_t i = 0; i < v.getArraySize(); ++i)
+			n += countNodes(*v.getArrayElement(i));
+	else if (v.type() == VALUE_TYPE_OBJECT)
+		for (size_t i = 0; i < v.getObjectSize(); ++i)
+			n += countNodes(*v.getObjectValue(i));
+	return n;
+}
+
+static double walk(const Value &v)
+{
+	switch (v.type()) {
+	case VALUE_TYPE_TRUE: return 1;
+	case VALUE_TYPE_NUMBER: case VALUE_TYPE_INT64: case VALUE_TYPE_UINT64: return v.getNumber();
+	case VALUE_TYPE_STRING: return static_cast<unsigned char>(v.getString()[v.getStringLength() / 2]);
+	case VALUE_TYPE_ARRAY: {
+		double sum = 0;
+		for (size_t i = 0; i < v.getArraySize(); ++i)
+			sum += walk(*v.getArrayElement(i));
+		return sum;
+	}
+	case VALUE_TYPE_OBJECT: {
+		double sum = 0;
+		for (size_t i = 0; i < v.getObjectSize(); ++i)
+			sum += v.getObjectKey(i)[0] + walk(*v.getObjectValue(i));
+		return sum;
+	}
+	default: return 0;
+	}
+}
+
+/* memory per node and traversal speed of the layout this was built with (make bench-compact for the other) */
+static void benchLayout()
+{
+#ifdef AJ_COMPACT_VALUE
+	printf("layout: compact, sizeof(Value) %zu, sizeof(Member) %zu\n", sizeof(Value), sizeof(Member));
+#else
+	printf("layout: default, sizeof(Value) %zu, sizeof(Member) %zu\n", sizeof(Value), sizeof(Member));
+#endif
+	std::string scalars = "[";
+	for (size_t i = 0; i < 1000000; ++i) {
+		if (i)
+			scalars += ',';
+		scalars += i % 3 ? std::to_string(i % 1000) : std::string("true");
+	}
+	scalars += "]";
+	const struct { const char *name; std::string json; } docs[] = {
+		{ "small numbers/bools", scalars },
+		{ "log records", makeLogLines(200000) },
+		{ "nested records", makeIndented(50000) },
+	};
+	for (auto &doc : docs) {
+		Document d;
+		d.parse(doc.json.data(), doc.json.size());
+		size_t nodes = countNodes(d);
+		const int iterations = 10;
+		double sum = 0, t0 = now();
+		for (int i = 0; i < iterations; ++i)
+			sum += walk(d);
+		double t = (now() - t0) / iterations;
+		printf("  %-20s %8zu nodes  %5.1f bytes/node  walk %6.2f ms  %5.2f ns/node%s\n", doc.name, nodes,
+			static_cast<double>(d.arena().used()) / nodes, t * 1e3, t / nodes * 1e9, sum < 0 ? "!" : "");
+	}
+}
+
+static double walk(Tape::Cursor c)
+{
+	switch (c.type()) {
+	case VALUE_TYPE_TRUE: return 1;
+	case VALUE_TYPE_NUMBER: case VALUE_TYPE_INT64: case VALUE_TYPE_UINT64: return c.getNumber();
+	case VALUE_TYPE_STRING: return static_cast<unsigned char>(c.getString()[c.getStringLength() / 2]);
+	case VALUE_TYPE_ARRAY: {
+		double sum = 0;
+		for (Tape::Cursor e = c.first(); e; e = e.next())
+			sum += walk(e);
+		return sum;
+	}
+	case VALUE_TYPE_OBJECT: {
+		double sum = 0;
+		for (Tape::Cursor k = c.first(); k; k = k.next().next())
+			sum += k.getString()[0] + walk(k.next());
+		return sum;
+	}
+	default: return 0;
+	}
+}
+
+/* pointer tree vs tape: parse, a full walk, and one field of every record */
+static void benchTape()
+{
+	const std::string json = makeLogLines(200000);
+	const int iterations = 10;
+	printf("tape: %.1f MB, 200000 records\n", json.size() / 1e6);
+
+	Document d;
+	double parse = 0, full = 0, field = 0, sum = 0;
+	for (int i = 0; i < iterations; ++i) {
+		double t0 = now();
+		d.parse(json.data(), json.size());
+		parse += now() - t0;
+		t0 = now();
+		sum += walk(d);
+		full += now() - t0;
+		t0 = now();
+		for (size_t r = 0; r < d.getArraySize(); ++r)
+			sum += d.getArrayElement(r)->findMember("path")->getStringLength();
+		field += now() - t0;
+	}
+	printf("  Document  parse %7.1f MB/s  walk %6.2f ms  field %6.2f ms\n", json.size() * iterations / parse / 1e6,
+		full / iterations * 1e3, field / iterations * 1e3);
+
+	Tape t;
+	parse = full = field = 0;
+	for (int i = 0; i < iterations; ++i) {
+		double t0 = now();
+		t.parse(json.data(), json.size());
+		parse += now() - t0;
+		t0 = now();
+		sum += walk(t.root());
+		full += now() - t0;
+		t0 = now();
+		for (Tape::Cursor r = t.root().first(); r; r = r.next())
+			sum += r.findMember("path").getStringLength();
+		field += now() - t0;
+	}
+	printf("  Tape      parse %7.1f MB/s  walk %6.2f ms  field %6.2f ms  (%zu words, %zu structurals)%s\n",
+		json.size() * iterations / parse / 1e6, full / iterations * 1e3, field / iterations * 1e3, t.size(),
+		t.structurals(), sum < 0 ? "!" : "");
+}
+
+/* a ~2 KB message of which a router reads three fields */
+static std::string makeMessage(size_t i)
+{
+	char buf[256];
+	snprintf(buf, sizeof(buf), "{\"id\":%zu,\"type\":\"order.%s\",\"route\":{\"dest\":\"shard-%zu\",\"ttl\":30},\"body\":{",
+		i, i % 2 ? "created" : "updated", i % 64);
+	std::string s = buf;
+	for (size_t f = 0; f < 24; ++f) {
+		snprintf(buf, sizeof(buf), "%s\"field%zu\":{\"note\":\"line one\\nline \\u00e9 %zu\",\"v\":[%zu.%03zu,%zu,true]}",
+			f ? "," : "", f, i, i + f, f * 37 % 1000, f * 1000003);
+		s += buf;
+	}
+	return s + "}}";
+}
+
+/* read three fields out of many small messages: full trees vs tapes vs on-demand tapes */
+static void benchLazy()
+{
+	std::vector<std::string> messages;
+	size_t bytes = 0;
+	for (size_t i = 0; i < 20000; ++i) {
+		messages.push_back(makeMessage(i));
+		bytes += messages.back().size();
+	}
+	const int iterations = 10;
+	printf("lazy: %zu messages of %zu bytes, 3 fields read from each\n", messages.size(), bytes / messages.size());
+	size_t sum = 0;
+
+	Parser parser;
+	Value v;
+	double t0 = now();
+	for (int i = 0; i < iterations; ++i)
+		for (const std::string &m : messages) {
+			parser.parse(v, m.data(), m.size());
+			sum += v["id"].getInt64() + v["type"].getStringLength() + v["route"]["dest"].getStringLength();
+		}
+	double value = now() - t0;
+
+	Document d;
+	t0 = now();
+	for (int i = 0; i < iterations; ++i)
+		for (const std::string &m : messages) {
+			d.parse(m.data(), m.size());
+			sum += d["id"].getInt64() + d["type"].getStringLength() + d["route"]["dest"].getStringLength();
+		}
+	double document = now() - t0;
+
+	Tape t;
+	double tape[2];
+	for (int lazy = 0; lazy < 2; ++lazy) {
+		t0 = now();
+		for (int i = 0; i < iterations; ++i)
+			for (const std::string &m : messages) {
+				if (lazy)
+					t.parseLazy(m.data(), m.size());
+				else
+					t.parse(m.data(), m.size());
+				Tape::Cursor r = t.root();
+				sum += r.findMember("id").getInt64() + r.findMember("type").getStringLength()
+					+ r.findMember("route").findMember("dest").getStringLength();
+			}
+		tape[lazy] = now() - t0;
+	}
+	const double n = double(messages.size()) * iterations;
+	printf("  Value     %6.2f us/msg\n", value / n * 1e6);
+	printf("  Document  %6.2f us/msg\n", document / n * 1e6);
+	printf("  Tape      %6.2f us/msg\n", tape[0] / n * 1e6);
+	printf("  lazy Tape %6.2f us/msg  (%zu string bytes decoded of the last)%s\n", tape[1] / n * 1e6, t.stringBytes(),
+		sum == 0 ? "!" : "");
+}
+
+/* a 100000-record response: text re-parsed into a tree, a tree built in code, or streamed */
+static void benchBuild()
+{
+	const size_t records = 100000;
+	const int iterations = 5;
+	double text = 0, tree = 0, stream = 0;
+	size_t bytes = 0;
+	for (int i = 0; i < iterations; ++i) {
+		double t0 = now();
+		{
+			Value v;
+			v.parse(makeRecords(records));
+			bytes += v.stringify().size();
+		}
+		text += now() - t0;
+
+		t0 = now();
+		{
+			Value v;
+			v.setArray();
+			char name[32];
+			for (size_t r = 0; r < records; ++r) {
+				Value &o = v.pushBack(Value());
+				o.setObject(6);
+				o.addMember("id", Value()).setInt64(static_cast<int64_t>(r));
+				snprintf(name, sizeof(name), "user-%zu", r);
+				o.addMember("name", Value()).setString(name, strlen(name));
+				o.addMember("active", Value()).setBool(r % 3 != 0);
+				o.addMember("score", Value()).setNumber(r * 0.37);
+				Value &tags = o.addMember("tags", Value());
+				tags.setArray(3);
+				tags.pushBack(Value()).setString("a", 1);
+				tags.pushBack(Value()).setString("bb", 2);
+				tags.pushBack(Value()).setString("ccc", 3);
+				Value &geo = o.addMember("geo", Value());
+				geo.setObject(2);
+				geo.addMember("lat", Value()).setNumber((r % 180) - 90.0 + 0.123456);
+				geo.addMember("lon", Value()).setNumber((r % 360) - 180.0 + 0.654321);
+			}
+			bytes += v.stringify().size();
+		}
+		tree += now() - t0;
+
+		t0 = now();
+		{
+			StringSink out;
+			Writer w(out);
+			char name[32];
+			w.startArray();
+			for (size_t r = 0; r < records; ++r) {
+				w.startObject();
+				w.key("id"); w.int64(static_cast<int64_t>(r));
+				snprintf(name, sizeof(name), "user-%zu", r);
+				w.key("name"); w.string(name);
+				w.key("active"); w.boolean(r % 3 != 0);
+				w.key("score"); w.number(r * 0.37);
+				w.key("tags"); w.startArray(); w.string("a"); w.string("bb"); w.string("ccc"); w.endArray();
+				w.key("geo"); w.startObject();
+				w.key("lat"); w.number((r % 180) - 90.0 + 0.123456);
+				w.key("lon"); w.number((r % 360) - 180.0 + 0.654321);
+				w.endObject();
+				w.endObject();
+			}
+			w.endArray();
+			w.flush();
+			bytes += out.str().size();
+		}
+		stream += now() - t0;
+	}
+	printf("build: %zu records, %.1f MB of output\n", records, bytes / 3.0 / iterations / 1e6);
+	printf("  text + parse + stringify  %7.2f ms\n", text / iterations * 1e3);
+	printf("  tree in code + stringify  %7.2f ms\n", tree / iterations * 1e3);
+	printf("  Writer to a string        %7.2f ms\n", stream / iterations * 1e3);
+}
+
+/* serializing string-heavy trees: log records, and 1 MB strings with and without escapes */
+static void benchStringify()
+{
+	static const char *names[] = { "scalar", "SSE2", "AVX2" };
+	Value logs;
+	logs.parse(makeLogLines(100000));
+	std::string big(1 << 20, 'a'), escaped = big;
+	for (size_t i = 0; i < escaped.size(); i += 64)
+		escaped[i] = i % 128 ? '"' : '\n';
+	Value plain, sparse;
+	plain.setString(big.data(), big.size());
+	sparse.setString(escaped.data(), escaped.size());
+	const Value *values[] = { &logs, &plain, &sparse };
+	const char *valueNames[] = { "log records", "1 MB plain", "1 MB, escape/64B" };
+	const int iterations = 20;
+	SimdLevel best = simdLevel();
+
+	printf("stringify:\n");
+	for (int k = 0; k < 3; ++k)
+		for (int level = SIMD_NONE; level <= best; ++level) {
+			setSimdLevel(static_cast<SimdLevel>(level));
+			size_t bytes = 0;
+			double t0 = now();
+			for (int i = 0; i < iterations; ++i)
+				bytes += values[k]->stringify().size();
+			double t = now() - t0;
+			printf("  %-17s %-6s %8.1f MB/s\n", valueNames[k], names[level], bytes / t / 1e6);
+		}
+	setSimdLevel(best);
+}
+
+/* compact vs pretty output of the same trees, in MB of compact JSON per second */
+static void benchPretty()
+{
+	Value records, logs;
+	records.parse(makeRecords(100000));
+	logs.parse(makeLogLines(100000));
+	const Value *values[] = { &records, &logs };
+	const char *valueNames[] = { "records", "log records" };
+	PrettyFormat spaces, tabs, sorted;
+	tabs.indent = 1;
+	tabs.indentChar = '\t';
+	sorted.sortKeys = true;
+	const int iterations = 10;
+
+	printf("pretty:\n");
+	for (int k = 0; k < 2; ++k) {
+		const Value &v = *values[k];
+		const size_t compact = v.stringify().size();
+		double t[4] = {};
+		size_t sizes[4] = {};
+		for (int i = 0; i < iterations; ++i) {
+			double t0 = now();
+			sizes[0] = v.stringify().size();
+			t[0] += now() - t0;
+			t0 = now();
+			sizes[1] = v.stringify(spaces).size();
+			t[1] += now() - t0;
+			t0 = now();
+			sizes[2] = v.stringify(tabs).size();
+			t[2] += now() - t0;
+			t0 = now();
+			sizes[3] = v.stringify(sorted).size();
+			t[3] += now() - t0;
+		}
+		const char *modes[] = { "compact", "4 spaces", "tabs", "4 spaces, sorted" };
+		for (int m = 0; m < 4; ++m)
+			printf("  %-12s %-17s %7.1f MB/s  (%5.1f MB out)\n", valueNames[k], modes[m],
+				compact * iterations / t[m] / 1e6, sizes[m] / 1e6);
+	}
+}
+
+/* stringify to /dev/null: the whole string first vs stringifyTo through its buffer */
+static void benchSink()
+{
+	const std::string json = makeRecords(200000);
+	printf("sink: %.1f MB document\n", json.size() / 1e6);
+	const char *modes[] = { "parse only", "stringify + write", "stringifyTo(fd)" };
+	for (int m = 0; m < 3; ++m) {
+		double rss = peakRssOf([&json, &modes, m] {
+			Value v;
+			v.parse(json);
+			int fd = open("/dev/null", O_WRONLY);
+			double t0 = now();
+			if (m == 1) {
+				std::string s = v.stringify();
+				FdSink(fd).write(s.data(), s.size());
+			} else if (m == 2) {
+				v.stringifyTo(fd);
+			}
+			printf("  %-18s %7.1f ms", modes[m], (now() - t0) * 1e3);
+			close(fd);
+		});
+		printf("  peak RSS %6.1f MB\n", rss);
+	}
+}
+
+/* deeply nested documents: parse, stringify, copy and free, none of which recurse */
+static void benchDepth()
+{
+	const size_t depths[] = { 1000, 100000, 1000000 };
+	Parser p;
+	p.setMaxDepth(SIZE_MAX);
+	printf("depth:\n");
+	for (size_t depth : depths) {
+		std::string json;
+		for (size_t i = 0; i < depth; ++i)
+			json += "{\"k\":[";
+		for (size_t i = 0; i < depth; ++i)
+			json += "]}";
+		double t0 = now();
+		Value *v = new Value;
+		ParseResult res = p.parse(*v, json.c_str(), json.size());
+		double t1 = now();
+		bool same = v->stringify() == json;
+		double t2 = now();
+		Value copy = v->deepCopy();
+		double t3 = now();
+		delete v;
+		double t4 = now();
+		printf("  %8zu levels  %s  parse %7.1f ms  stringify %7.1f ms  copy %7.1f ms  free %7.1f ms\n", depth * 2,
+			res == PARSE_OK && same ? "ok  " : "FAIL", (t1 - t0) * 1e3, (t2 - t1) * 1e3, (t3 - t2) * 1e3, (t4 - t3) * 1e3);
+	}
+	Value v;
+	std::string hostile(100 * 1000 * 1000, '[');
+	double t0 = now();
+	ParseResult res = v.parse(hostile);
+	printf("  100 MB of '[' at the default limit: %s in %.3f ms\n",
+		res == PARSE_DEPTH_EXCEEDED ? "PARSE_DEPTH_EXCEEDED" : "unexpected result", (now() - t0) * 1e3);
+}
+
+struct Bench {
+	const char *name;
+	void (*run)();
+};
+
+static const Bench s_benches[] = {
+	{ "threads", benchThreads },
+	{ "reuse", benchReuse },
+	{ "arena", benchArena },
+	{ "insitu", benchInsitu },
+	{ "simd", benchSimd },
+	{ "numbers", benchNumbers },
+	{ "integers", benchIntegers },
+	{ "doubles", benchDoubles },
+	{ "sax", benchSax },
+	{ "push", benchPush },
+	{ "ndjson", benchNdjson },
+	{ "file", benchFile },
+	{ "members", benchMembers },
+	{ "keys", benchKeys },
+	{ "layout", benchLayout },
+	{ "tape", benchTape },
+	{ "lazy", benchLazy },
+	{ "build", benchBuild },
+	{ "stringify", benchStringify },
+	{ "pretty", benchPretty },
+	{ "sink", benchSink },
+	{ "depth", benchDepth },
+};
+
+int main(int argc, char *argv[])
+{
+	for (auto &b : s_benches) {
+		bool selected = argc < 2;
+		for (int i = 1; i < argc; ++i)
+			if (strcmp(argv[i], b.name) == 0)
+				selected = true;
+		if (selected)
+			b.run();
+	}
+	return 0;
+}
@@ -8,6 +8,14 @@
 #endif // AJ_MEMORY_LEAK_DETECT
 
 #include "AJson.h"
+#include <algorithm>
+#include <atomic>
+#include <clocale>
+#include <cmath>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <vector>
 using namespace AJson;
 
 TEST_CASE("parseLiteral", "[parse][literal]")
@@ -25,7 +33,7 @@ TEST_CASE("parseLiteral", "[parse][literal]")
     do {									\
         Value v;							\
         REQUIRE(PARSE_OK == v.parse(json));	\
-        REQUIRE(VALUE_TYPE_NUMBER == v.type());\
+        REQUIRE(v.isNumber());				\
         REQUIRE(expect == v.getNumber());	\
     } while (0)
 
@@ -67,11 +75,104 @@ TEST_CASE("parseNumber", "[parse][number]")
 	TEST_NUMBER(-1.7976931348623157e308, "-1.7976931348623157e308");
 }
 
+TEST_CASE("parseNumberSlowPath", "[parse][number]")
+{
+	TEST_NUMBER(9007199254740993.0, "9007199254740993"); /* 2^53 + 1 */
+	TEST_NUMBER(0.1, "0.1");
+	TEST_NUMBER(0.30000000000000004, "0.30000000000000004440892098500626161694526672363281");
+	TEST_NUMBER(1.2345678901234567e29, "123456789012345678901234567890");
+	TEST_NUMBER(1e23, "1e23");
+	TEST_NUMBER(1e37, "10000000000000000000000000000000000000");
+	TEST_NUMBER(1.2e38, "12e37");
+	TEST_NUMBER(1e-300, "0.000000000000000000000000000000000000001e-261");
+	TEST_NUMBER(0.0, "0e999999999999999999");
+	TEST_NUMBER(0.0, "0.0000000000000000000000000000000");
+	TEST_NUMBER(1.5, "1.50000000000000000000000000000000000000000000000000000000000000");
+	TEST_NUMBER(1.7976931348623157e308, (std::string("17976931348623157") + std::string(292, '0')).c_str());
+}
+
+TEST_CASE("parseNumberLocale", "[parse][number]")
+{
+	/* a locale with ',' as decimal separator must not change the result */
+	const char *locales[] = { "de_DE.UTF-8", "de_DE.utf8", "de_DE", "fr_FR.UTF-8" };
+	for (const char *name : locales) {
+		if (setlocale(LC_NUMERIC, name) == nullptr)
+			continue;
+		TEST_NUMBER(1.5, "1.5");
+		TEST_NUMBER(3.1416, "3.1416");
+		TEST_NUMBER(1.0000000000000002, "1.0000000000000002");
+		TEST_NUMBER(2.2250738585072009e-308, "2.2250738585072009e-308");
+		setlocale(LC_NUMERIC, "C");
+	}
+}
+
+#define TEST_INT64(expect, json)			\
+    do {									\
+        Value v;							\
+        REQUIRE(PARSE_OK == v.parse(json));	\
+        REQUIRE(VALUE_TYPE_INT64 == v.type());\
+        REQUIRE(expect == v.getInt64());	\
+    } while (0)
+
+TEST_CASE("parseInt64", "[parse][number][int64]")
+{
+	TEST_INT64(0, "0");
+	TEST_INT64(1, "1");
+	TEST_INT64(-1, "-1");
+	TEST_INT64(9007199254740993LL, "9007199254740993"); /* 2^53 + 1, not representable as double */
+	TEST_INT64(1700000000123456789LL, "1700000000123456789");
+	TEST_INT64(INT64_MAX, "9223372036854775807");
+	TEST_INT64(INT64_MIN, "-9223372036854775808");
+
+	Value v;
+	REQUIRE(PARSE_OK == v.parse("9223372036854775808"));
+	REQUIRE(VALUE_TYPE_UINT64 == v.type());
+	REQUIRE(9223372036854775808ULL == v.getUint64());
+	REQUIRE(PARSE_OK == v.parse("18446744073709551615"));
+	REQUIRE(VALUE_TYPE_UINT64 == v.type());
+	REQUIRE(UINT64_MAX == v.getUint64());
+	REQUIRE(18446744073709551615.0 == v.getNumber());
+
+	/* beyond 64 bits, fractions, exponents and negative zero stay doubles */
+	REQUIRE(PARSE_OK == v.parse("18446744073709551616"));
+	REQUIRE(VALUE_TYPE_NUMBER == v.type());
+	REQUIRE(18446744073709551616.0 == v.getNumber());
+	REQUIRE(PARSE_OK == v.parse("-9223372036854775809"));
+	REQUIRE(VALUE_TYPE_NUMBER == v.type());
+	REQUIRE(PARSE_OK == v.parse("1.0"));
+	REQUIRE(VALUE_TYPE_NUMBER == v.type());
+	REQUIRE(PARSE_OK == v.parse("1e2"));
+	REQUIRE(VALUE_TYPE_NUMBER == v.type());
+	REQUIRE(PARSE_OK == v.parse("-0"));
+	REQUIRE(VALUE_TYPE_NUMBER == v.type());
+	REQUIRE(std::signbit(v.getNumber()));
+}
+
+TEST_CASE("accessInt64", "[access][int64]")
+{
+	Value v;
+	v.setInt64(-42);
+	REQUIRE(VALUE_TYPE_INT64 == v.type());
+	REQUIRE(-42 == v.getInt64());
+	REQUIRE(-42.0 == v.getNumber());
+	v.setUint64(42);
+	REQUIRE(VALUE_TYPE_INT64 == v.type());
+	REQUIRE(42 == v.getUint64());
+	v.setUint64(UINT64_MAX);
+	REQUIRE(VALUE_TYPE_UINT64 == v.type());
+	REQUIRE(UINT64_MAX == v.getUint64());
+}
+
 #define TEST_ERROR(error, json)             \
     do {                                    \
         Value v;                            \
         REQUIRE(error == v.parse(json));	\
         REQUIRE(VALUE_TYPE_NULL == v.type());\
+        Tape t;								\
+        REQUIRE(error == t.parse(json));	\
+        REQUIRE(!t.root());					\
+        REQUIRE(error == t.parseLazy(json));\
+        REQUIRE(!t.root());					\
     } while (0)
 
 TEST_CASE("parseExpectValue", "[parse][error]")
@@ -308,6 +409,64 @@ TEST_CASE("parseMissCommaOrCurlyBracket", "[parse][error]")
 	TEST_ERROR(PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\":{}");
 }
 
+static std::string nested(size_t depth, const char *open = "[", const char *close = "]")
+{
+	std::string json;
+	for (size_t i = 0; i < depth; ++i)
+		json += open;
+	for (size_t i = 0; i < depth; ++i)
+		json += close;
+	return json;
+}
+
+TEST_CASE("parseDepth", "[parse][error][depth]")
+{
+	TEST_ERROR(PARSE_DEPTH_EXCEEDED, nested(AJ_PARSE_MAX_DEPTH + 1).c_str());
+	TEST_ERROR(PARSE_DEPTH_EXCEEDED, nested(AJ_PARSE_MAX_DEPTH / 2 + 1, "{\"a\":[", "]}").c_str());
+	/* a hostile payload fails at the limit, not at the end of the input */
+	TEST_ERROR(PARSE_DEPTH_EXCEEDED, std::string(1000000, '[').c_str());
+	Value v;
+	REQUIRE(PARSE_OK == v.parse(nested(AJ_PARSE_MAX_DEPTH)));
+	Handler h;
+	REQUIRE(PARSE_DEPTH_EXCEEDED == parse(h, nested(1000000, "{\"\":", "}").c_str()));
+	PushParser push(h);
+	REQUIRE(PARSE_DEPTH_EXCEEDED == push.feed(std::string(1000000, '[')));
+	REQUIRE(PARSE_DEPTH_EXCEEDED == push.finish());
+
+	Parser p;
+	p.setMaxDepth(3);
+	REQUIRE(PARSE_OK == p.parse(v, "[{\"a\":[]},[[1]]]"));
+	REQUIRE(PARSE_DEPTH_EXCEEDED == p.parse(v, "[{\"a\":[{}]}]"));
+	REQUIRE(VALUE_TYPE_NULL == v.type());
+	REQUIRE(PARSE_DEPTH_EXCEEDED == p.parse(h, "[[[[]]]]"));
+	Tape t;
+	t.setMaxDepth(3);
+	REQUIRE(PARSE_OK == t.parse("[{\"a\":[]},[[1]]]"));
+	REQUIRE(PARSE_DEPTH_EXCEEDED == t.parse("[{\"a\":[{}]}]"));
+	push.setMaxDepth(3);
+	REQUIRE(PARSE_OK == push.feed("[{\"a\":[]},[[1]]]"));
+	REQUIRE(PARSE_OK == push.finish());
+	REQUIRE(PARSE_DEPTH_EXCEEDED == push.feed("[{\"a\":[{}]}]"));
+	REQUIRE(PARSE_DEPTH_EXCEEDED == push.finish());
+
+	/* parsing, stringifying, copying and freeing take no C stack per level */
+	const std::string deep = nested(500000, "{\"k\":[", "]}");
+	p.setMaxDepth(SIZE_MAX);
+	REQUIRE(PARSE_OK == p.parse(v, deep.c_str()));
+	REQUIRE(deep == v.stringify());
+	Value copy = v.deepCopy();
+	v.setNull();
+	REQUIRE(deep == copy.stringify());
+	Document d;
+	REQUIRE(PARSE_OK == p.parse(d, deep.c_str()));
+	REQUIRE(deep == d.stringify());
+	const std::string deepPretty = nested(3000);
+	REQUIRE(PARSE_OK == p.parse(v, deepPretty.c_str()));
+	Value back;
+	REQUIRE(PARSE_OK == p.parse(back, v.stringify(PrettyFormat()).c_str()));
+	REQUIRE(deepPretty == back.stringify());
+}
+
 TEST_CASE("parseObject", "[parse][object]")
 {
 	Value v;
@@ -335,7 +494,7 @@ TEST_CASE("parseObject", "[parse][object]")
 	REQUIRE_STRING("t", v.getObjectKey(2), v.getObjectKeyLength(2));
 	REQUIRE(VALUE_TYPE_TRUE == v.getObjectValue(2)->type());
 	REQUIRE_STRING("i", v.getObjectKey(3), v.getObjectKeyLength(3)); 
-	REQUIRE(VALUE_TYPE_NUMBER == v.getObjectValue(3)->type());
+	REQUIRE(VALUE_TYPE_INT64 == v.getObjectValue(3)->type());
 	REQUIRE(123.0 == v.getObjectValue(3)->getNumber());
 	REQUIRE_STRING("s", v.getObjectKey(4), v.getObjectKeyLength(4));
 	REQUIRE(VALUE_TYPE_STRING == v.getObjectValue(4)->type());
@@ -346,7 +505,7 @@ TEST_CASE("parseObject", "[parse][object]")
 	REQUIRE(3 == v.getObjectValue(5)->getArraySize());
 	for (auto i = 0; i < 3; ++i) {
 		Value *e = v.getObjectValue(5)->getArrayElement(i);
-		REQUIRE(VALUE_TYPE_NUMBER == e->type());
+		REQUIRE(VALUE_TYPE_INT64 == e->type());
 		REQUIRE((i + 1.0) == e->getNumber());
 	}
 	REQUIRE_STRING("o", v.getObjectKey(6), v.getObjectKeyLength(6));
@@ -357,7 +516,7 @@ TEST_CASE("parseObject", "[parse][object]")
 			REQUIRE(('1' + i) == o->getObjectKey(i)[0]);
 			REQUIRE(1 == o->getObjectKeyLength(i));
 			Value* ov = o->getObjectValue(i);
-			REQUIRE(VALUE_TYPE_NUMBER == ov->type());
+			REQUIRE(VALUE_TYPE_INT64 == ov->type());
 			REQUIRE((i + 1.0) == ov->getNumber());
 		}
 	}
@@ -378,6 +537,1497 @@ TEST_CASE("stringify", "[stringify]")
 	TEST_ROUNDTRIP("false");
 }
 
+TEST_CASE("stringifyInt64", "[stringify][int64]")
+{
+	TEST_ROUNDTRIP("0");
+	TEST_ROUNDTRIP("7");
+	TEST_ROUNDTRIP("-10");
+	TEST_ROUNDTRIP("1234567890");
+	TEST_ROUNDTRIP("9007199254740993");
+	TEST_ROUNDTRIP("9223372036854775807");
+	TEST_ROUNDTRIP("-9223372036854775808");
+	TEST_ROUNDTRIP("18446744073709551615");
+	TEST_ROUNDTRIP("[1,-2,300,-4000]");
+}
+
+TEST_CASE("stringifyDouble", "[stringify][number]")
+{
+	TEST_ROUNDTRIP("0.0");
+	TEST_ROUNDTRIP("-0.0");
+	TEST_ROUNDTRIP("1.0");
+	TEST_ROUNDTRIP("-1.5");
+	TEST_ROUNDTRIP("0.1");
+	TEST_ROUNDTRIP("0.30000000000000004");
+	TEST_ROUNDTRIP("3.1416");
+	TEST_ROUNDTRIP("0.001234");
+	TEST_ROUNDTRIP("1.234e-7");
+	TEST_ROUNDTRIP("1e30");
+	TEST_ROUNDTRIP("1.2345e30");
+	TEST_ROUNDTRIP("100000000000000000000.0");
+	TEST_ROUNDTRIP("1e21");
+	TEST_ROUNDTRIP("1.7976931348623157e308");
+	TEST_ROUNDTRIP("2.2250738585072014e-308");
+	TEST_ROUNDTRIP("5e-324");
+	TEST_ROUNDTRIP("[0.5,-2.25,1e-10]");
+
+	Value v;
+	v.setNumber(1e22);
+	REQUIRE(v.stringify() == "1e22");
+	v.setNumber(123e-9);
+	REQUIRE(v.stringify() == "1.23e-7");
+}
+
+TEST_CASE("stringifyDoubleExact", "[stringify][number]")
+{
+	uint64_t x = 88172645463325252ull;
+	for (int i = 0; i < 100000; ++i) {
+		x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+		double d;
+		memcpy(&d, &x, sizeof(d));
+		if (!std::isfinite(d))
+			continue;
+		Value v;
+		v.setNumber(d);
+		std::string s = v.stringify();
+		INFO(s);
+		REQUIRE(PARSE_OK == v.parse(s));
+		REQUIRE(v.type() == VALUE_TYPE_NUMBER);
+		double r = v.getNumber();
+		REQUIRE(memcmp(&d, &r, sizeof(d)) == 0);
+	}
+}
+
+/* what stringify should make of a string, a byte at a time */
+static std::string escapeString(const std::string &s)
+{
+	std::string out = "\"";
+	for (unsigned char ch : s) {
+		switch (ch) {
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\b': out += "\\b"; break;
+		case '\f': out += "\\f"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		default:
+			if (ch < 0x20) {
+				char u[8];
+				snprintf(u, sizeof(u), "\\u%04X", ch);
+				out += u;
+			} else {
+				out += static_cast<char>(ch);
+			}
+		}
+	}
+	return out + "\"";
+}
+
+TEST_CASE("stringifyString", "[stringify][string]")
+{
+	TEST_ROUNDTRIP("\"\"");
+	TEST_ROUNDTRIP("\"Hello\"");
+	TEST_ROUNDTRIP("\"Hello\\nWorld\"");
+	TEST_ROUNDTRIP("\"\\\" \\\\ / \\b \\f \\n \\r \\t\"");
+	TEST_ROUNDTRIP("\"Hello\\u0000World\"");
+	TEST_ROUNDTRIP("\"\\u0001\\u001F\"");
+	/* UTF-8 is copied through, not escaped */
+	TEST_ROUNDTRIP("\"\xE2\x82\xAC \xF0\x9D\x84\x9E \xC3\xA9\"");
+
+	/* every special byte at every offset of a few vector widths, at each SIMD level */
+	const char specials[] = { '"', '\\', '\0', '\x01', '\n', '\x1f', '\x7f', '\x80', '\xff' };
+	SimdLevel best = simdLevel();
+	for (int level = SIMD_NONE; level <= best; ++level) {
+		REQUIRE(level == setSimdLevel(static_cast<SimdLevel>(level)));
+		for (size_t len = 1; len <= 70; ++len)
+			for (size_t at = 0; at < len; ++at)
+				for (char ch : specials) {
+					std::string s(len, 'x');
+					s[at] = ch;
+					s[len - 1 - at] = ch;
+					Value v;
+					v.setString(s.data(), s.size());
+					REQUIRE(escapeString(s) == v.stringify());
+				}
+	}
+	setSimdLevel(best);
+
+	/* strings long enough to be escaped a piece at a time: long plain runs, and escapes around piece edges */
+	for (size_t len : { size_t(4097), size_t(20000) })
+		for (size_t at : { size_t(0), size_t(4095), size_t(4096), size_t(4097), size_t(8191), len - 1 }) {
+			std::string s(len, 'x');
+			if (at < len)
+				s[at] = '\n';
+			s[len / 2] = '"';
+			Value v;
+			v.setString(s.data(), s.size());
+			REQUIRE(escapeString(s) == v.stringify());
+		}
+}
+
+TEST_CASE("stringifyPretty", "[stringify][pretty]")
+{
+	Value v;
+	REQUIRE(PARSE_OK == v.parse("{\"b\":[1,[],{}],\"a\":{\"y\":null,\"x\":\"s\"},\"\":true,\"a\":2}"));
+	PrettyFormat f;
+	REQUIRE(v.stringify(f) ==
+		"{\n"
+		"    \"b\": [\n"
+		"        1,\n"
+		"        [],\n"
+		"        {}\n"
+		"    ],\n"
+		"    \"a\": {\n"
+		"        \"y\": null,\n"
+		"        \"x\": \"s\"\n"
+		"    },\n"
+		"    \"\": true,\n"
+		"    \"a\": 2\n"
+		"}");
+	f.indent = 1;
+	f.indentChar = '\t';
+	f.newline = "\r\n";
+	f.sortKeys = true;
+	REQUIRE(v.stringify(f) ==
+		"{\r\n"
+		"\t\"\": true,\r\n"
+		"\t\"a\": {\r\n"
+		"\t\t\"x\": \"s\",\r\n"
+		"\t\t\"y\": null\r\n"
+		"\t},\r\n"
+		"\t\"a\": 2,\r\n"
+		"\t\"b\": [\r\n"
+		"\t\t1,\r\n"
+		"\t\t[],\r\n"
+		"\t\t{}\r\n"
+		"\t]\r\n"
+		"}");
+	Value s;
+	s.setString("x", 1);
+	REQUIRE("\"x\"" == s.stringify(f));
+
+	/* deeper than the precomputed indentation, and back through the parser */
+	std::string deep;
+	for (int i = 0; i < 40; ++i)
+		deep += "[{\"k\":";
+	deep += "0";
+	for (int i = 0; i < 40; ++i)
+		deep += "}]";
+	REQUIRE(PARSE_OK == v.parse(deep));
+	f = PrettyFormat();
+	std::string pretty = v.stringify(f);
+	REQUIRE(pretty.find("\n" + std::string(80 * 4, ' ') + "\"k\": 0\n") != std::string::npos);
+	Value w;
+	REQUIRE(PARSE_OK == w.parse(pretty));
+	REQUIRE(deep == w.stringify());
+}
+
+/* remembers the largest piece that came from the buffer */
+struct ChunkSink : StringSink {
+	size_t largest = 0;
+	bool write(const char *s, size_t len) override
+	{
+		largest = std::max(largest, len);
+		return StringSink::write(s, len);
+	}
+	bool writev(const char *a, size_t alen, const char *b, size_t blen) override
+	{
+		largest = std::max(largest, alen);
+		return StringSink::write(a, alen) && StringSink::write(b, blen);
+	}
+};
+
+static std::string readAll(FILE *f)
+{
+	std::string text;
+	char chunk[4096];
+	rewind(f);
+	for (size_t n; (n = fread(chunk, 1, sizeof(chunk), f)) > 0;)
+		text.append(chunk, n);
+	return text;
+}
+
+TEST_CASE("stringifyTo", "[stringify][sink]")
+{
+	std::string json = "[";
+	for (int i = 0; i < 2000; ++i)
+		json += "{\"id\":" + std::to_string(i) + ",\"s\":\"tab\\there \\u0001\",\"a\":[true,null,1.5]},";
+	/* a long plain run, then one full of escapes */
+	json += "\"" + std::string(300000, 'x') + "\",\"";
+	for (int i = 0; i < 20000; ++i)
+		json += "\\n\\\"";
+	json += "\"]";
+	Value v;
+	REQUIRE(PARSE_OK == v.parse(json));
+	const std::string compact = v.stringify();
+	PrettyFormat f;
+	const std::string pretty = v.stringify(f);
+
+	for (size_t size : { size_t(1), size_t(7), size_t(256), size_t(AJ_STRINGIFY_BUFFER_SIZE) }) {
+		ChunkSink out;
+		REQUIRE(STRINGIFY_OK == v.stringifyTo(out, size));
+		REQUIRE(compact == out.str());
+		/* a buffer, what the last element added to it, and a piece of a string */
+		REQUIRE(out.largest <= size * 2 + 64);
+		ChunkSink prettyOut;
+		REQUIRE(STRINGIFY_OK == v.stringifyTo(prettyOut, f, size));
+		REQUIRE(pretty == prettyOut.str());
+	}
+
+	FILE *file = tmpfile();
+	REQUIRE(file != nullptr);
+	REQUIRE(STRINGIFY_OK == v.stringifyTo(file));
+	fflush(file);
+	REQUIRE(compact == readAll(file));
+	fclose(file);
+
+	file = tmpfile();
+	REQUIRE(file != nullptr);
+	REQUIRE(STRINGIFY_OK == v.stringifyTo(fileno(file)));
+	REQUIRE(compact == readAll(file));
+	fclose(file);
+
+	Value s;
+	s.setString("x", 1);
+	file = tmpfile();
+	REQUIRE(file != nullptr);
+	REQUIRE(STRINGIFY_OK == s.stringifyTo(fileno(file)));
+	REQUIRE("\"x\"" == readAll(file));
+	fclose(file);
+
+	char buf[4096];
+	FixedSink fixed(buf, sizeof(buf));
+	REQUIRE(STRINGIFY_WRITE_ERROR == v.stringifyTo(fixed, 1024));
+	REQUIRE(fixed.size() <= sizeof(buf));
+	REQUIRE(compact.compare(0, fixed.size(), buf, fixed.size()) == 0);
+
+	/* a whole DOM handed to a writer drains through its buffer as well */
+	ChunkSink written;
+	{
+		Writer w(written, 256);
+		REQUIRE(w.startArray());
+		REQUIRE(w.value(v));
+		REQUIRE(w.endArray());
+	}
+	REQUIRE("[" + compact + "]" == written.str());
+	REQUIRE(written.largest <= 256 * 2 + 64);
+
+	/* and so does a long string or key written on its own */
+	const Value &plain = *v.getArrayElement(2000), &escaped = *v.getArrayElement(2001);
+	ChunkSink strings;
+	{
+		Writer w(strings, 256);
+		REQUIRE(w.startObject());
+		REQUIRE(w.key(escaped.getString(), escaped.getStringLength()));
+		REQUIRE(w.string(plain.getString(), plain.getStringLength()));
+		REQUIRE(w.endObject());
+	}
+	REQUIRE("{" + escaped.stringify() + ":" + plain.stringify() + "}" == strings.str());
+	REQUIRE(strings.largest <= 256 * 2 + 64);
+}
+
+TEST_CASE("concurrent", "[parse][stringify][thread]")
+{
+	const char *json = "{\"a\":[1,2,3],\"s\":\"Hello World\",\"o\":{\"t\":true,\"n\":null}}";
+	std::vector<std::thread> workers;
+	std::vector<int> failures(4, 0);
+	for (int t = 0; t < 4; ++t) {
+		workers.emplace_back([json, t, &failures] {
+			for (int i = 0; i < 1000; ++i) {
+				Value v;
+				if (v.parse(json) != PARSE_OK || v.stringify() != json)
+					++failures[t];
+			}
+		});
+	}
+	for (auto &w : workers)
+		w.join();
+	for (int f : failures)
+		REQUIRE(0 == f);
+}
+
+TEST_CASE("parserReuse", "[parse][parser]")
+{
+	Parser p;
+	Value v;
+	REQUIRE(PARSE_OK == p.parse(v, "[\"a somewhat longer string than the initial scratch stack\", \"0123456789012345678901234567890123456789\","
+		"\"0123456789012345678901234567890123456789\", \"0123456789012345678901234567890123456789\",[1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20]]"));
+	REQUIRE(VALUE_TYPE_ARRAY == v.type());
+	REQUIRE(5 == v.getArraySize());
+	size_t reallocs = p.stats().reallocs;
+	REQUIRE(reallocs > 0);
+	for (int i = 0; i < 10; ++i) {
+		REQUIRE(PARSE_OK == p.parse(v, "[\"0123456789012345678901234567890123456789\", \"0123456789012345678901234567890123456789\","
+			"\"0123456789012345678901234567890123456789\",[1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20]]"));
+		REQUIRE(4 == v.getArraySize());
+	}
+	REQUIRE(11 == p.stats().documents);
+	REQUIRE(reallocs == p.stats().reallocs);
+	REQUIRE(p.stats().reallocsAvoided >= 10);
+	REQUIRE(p.stats().highWater > AJ_PARSE_STACK_INIT_SIZE);
+	REQUIRE(PARSE_MISS_COMMA_OR_SQUARE_BRACKET == p.parse(v, "[1,2"));
+	REQUIRE(VALUE_TYPE_NULL == v.type());
+	REQUIRE(0 == p.stats().shrinks);
+
+	p.setMaxRetained(64);
+	REQUIRE(PARSE_OK == p.parse(v, "\"x\""));
+	REQUIRE(64 == p.capacity());
+	REQUIRE(1 == p.stats().shrinks);
+	p.release();
+	REQUIRE(0 == p.capacity());
+	TEST_STRING("Hello", "\"Hello\"");
+	REQUIRE(PARSE_OK == p.parse(v, "\"Hello\""));
+	REQUIRE_STRING("Hello", v.getString(), v.getStringLength());
+
+	/* a one-byte stack still grows, whether reserved or shrunk to */
+	Parser tiny(1);
+	REQUIRE(PARSE_OK == tiny.parse(v, "[1,2,3]"));
+	REQUIRE(3 == v.getArraySize());
+	p.setMaxRetained(1);
+	REQUIRE(PARSE_OK == p.parse(v, "[1,2,3]"));
+	REQUIRE(1 == p.capacity());
+	REQUIRE(PARSE_OK == p.parse(v, "[\"0123456789\",[4,5]]"));
+	REQUIRE(2 == v.getArraySize());
+}
+
+TEST_CASE("document", "[parse][document]")
+{
+	Document d(256);
+	REQUIRE(PARSE_OK == d.parse("{\"a\":[1,\"two\",{\"three\":3}],\"s\":\"abc\",\"e\":[],\"o\":{}}"));
+	REQUIRE(VALUE_TYPE_OBJECT == d.type());
+	REQUIRE(4 == d.getObjectSize());
+	REQUIRE_STRING("a", d.getObjectKey(0), d.getObjectKeyLength(0));
+	Value *a = d.getObjectValue(0);
+	REQUIRE(3 == a->getArraySize());
+	REQUIRE(1.0 == a->getArrayElement(0)->getNumber());
+	REQUIRE_STRING("two", a->getArrayElement(1)->getString(), a->getArrayElement(1)->getStringLength());
+	REQUIRE_STRING("three", a->getArrayElement(2)->getObjectKey(0), a->getArrayElement(2)->getObjectKeyLength(0));
+	REQUIRE_STRING("abc", d.getObjectValue(1)->getString(), d.getObjectValue(1)->getStringLength());
+	REQUIRE(0 == d.getObjectValue(2)->getArraySize());
+	REQUIRE(0 == d.getObjectValue(3)->getObjectSize());
+	REQUIRE(d.arena().used() > 0);
+	REQUIRE(d.stringify() == "{\"a\":[1,\"two\",{\"three\":3}],\"s\":\"abc\",\"e\":[],\"o\":{}}");
+
+	/* strings larger than a chunk get a chunk of their own */
+	std::string big = "[\"" + std::string(1000, 'x') + "\",\"y\"]";
+	REQUIRE(PARSE_OK == d.parse(big.c_str()));
+	REQUIRE(1000 == d.getArrayElement(0)->getStringLength());
+	REQUIRE_STRING("y", d.getArrayElement(1)->getString(), d.getArrayElement(1)->getStringLength());
+	REQUIRE(2 == d.arena().chunks());
+
+	REQUIRE(PARSE_MISS_COMMA_OR_CURLY_BRACKET == d.parse("{\"a\":[\"x\"],\"b\":\"y\""));
+	REQUIRE(VALUE_TYPE_NULL == d.type());
+	REQUIRE(PARSE_OK == d.parse("true"));
+	REQUIRE(VALUE_TYPE_TRUE == d.type());
+	REQUIRE(0 == d.arena().used());
+
+	Parser p;
+	REQUIRE(PARSE_OK == p.parse(d, "[\"x\",[\"y\"]]"));
+	REQUIRE(2 == d.getArraySize());
+	REQUIRE(1 == p.stats().documents);
+}
+
+TEST_CASE("parseInsitu", "[parse][insitu]")
+{
+	char json[] = "{\"key\":\"plain\",\"k\\u0065y\":[\"a\\tb\",\"\\u20AC\\uD834\\uDD1E\"]}";
+	Value v;
+	REQUIRE(PARSE_OK == v.parseInsitu(json));
+	REQUIRE(2 == v.getObjectSize());
+	REQUIRE_STRING("key", v.getObjectKey(0), v.getObjectKeyLength(0));
+	REQUIRE(v.getObjectKey(0) == json + 2);
+	Value *s = v.getObjectValue(0);
+	REQUIRE_STRING("plain", s->getString(), s->getStringLength());
+	REQUIRE(s->getString() > json);
+	REQUIRE(s->getString() < json + sizeof(json));
+	REQUIRE_STRING("key", v.getObjectKey(1), v.getObjectKeyLength(1));
+	Value *a = v.getObjectValue(1);
+	REQUIRE_STRING("a\tb", a->getArrayElement(0)->getString(), a->getArrayElement(0)->getStringLength());
+	REQUIRE_STRING("\xE2\x82\xAC\xF0\x9D\x84\x9E", a->getArrayElement(1)->getString(), a->getArrayElement(1)->getStringLength());
+
+	char bad[] = "[\"a\",\"b\\x\"]";
+	REQUIRE(PARSE_INVALID_STRING_ESCAPE == v.parseInsitu(bad));
+	REQUIRE(VALUE_TYPE_NULL == v.type());
+
+	char missKey[] = "{\"a\":1,\"b";
+	REQUIRE(PARSE_MISS_KEY == v.parseInsitu(missKey));
+
+	char doc[] = "[\"x\",{\"y\":\"z\"}]";
+	Document d;
+	Parser p;
+	REQUIRE(PARSE_OK == p.parseInsitu(d, doc));
+	REQUIRE_STRING("z", d.getArrayElement(1)->getObjectValue(0)->getString(), 1);
+	REQUIRE(d.getArrayElement(0)->getString() == doc + 2);
+}
+
+TEST_CASE("parseUnicode", "[parse][string]")
+{
+	TEST_STRING("\x24", "\"\\u0024\"");
+	TEST_STRING("\xC2\xA2", "\"\\u00A2\"");
+	TEST_STRING("\xE2\x82\xAC", "\"\\u20AC\"");
+	TEST_STRING("\xF0\x9D\x84\x9E", "\"\\uD834\\uDD1E\"");
+	TEST_STRING("\xF4\x8F\xBF\xBF", "\"\\uDBFF\\uDFFF\"");
+}
+
+#define TEST_SLICE(error, json, len)			\
+	do {										\
+		std::vector<char> buf(json, json + len);	\
+		Value v;								\
+		REQUIRE(error == v.parse(buf.data(), buf.size()));\
+	} while (0)
+
+TEST_CASE("parseLength", "[parse][length]")
+{
+	Value v;
+	REQUIRE(PARSE_OK == v.parse("[1,2]xyz", 5));
+	REQUIRE(2 == v.getArraySize());
+	REQUIRE(PARSE_OK == v.parse("truex", 4));
+	REQUIRE(VALUE_TYPE_TRUE == v.type());
+	REQUIRE(PARSE_OK == v.parse("123456", 3));
+	REQUIRE(123.0 == v.getNumber());
+	REQUIRE(PARSE_OK == v.parse("\"abc\"def\"", 5));
+	REQUIRE_STRING("abc", v.getString(), v.getStringLength());
+	REQUIRE(PARSE_OK == v.parse(std::string("{\"a\":null}")));
+	REQUIRE(1 == v.getObjectSize());
+	REQUIRE(PARSE_INVALID_STRING_CHAR == v.parse(std::string("\"a\0b\"", 5)));
+
+	/* exact-size heap buffers, nothing readable past the end */
+	TEST_SLICE(PARSE_EXPECT_VALUE, "", 0);
+	TEST_SLICE(PARSE_INVALID_VALUE, "nul", 3);
+	TEST_SLICE(PARSE_INVALID_VALUE, "fals", 4);
+	TEST_SLICE(PARSE_INVALID_VALUE, "-", 1);
+	TEST_SLICE(PARSE_INVALID_VALUE, "1.", 2);
+	TEST_SLICE(PARSE_INVALID_VALUE, "1e", 2);
+	TEST_SLICE(PARSE_OK, "1e5", 3);
+	TEST_SLICE(PARSE_MISS_QUOTATION_MARK, "\"abc", 4);
+	TEST_SLICE(PARSE_MISS_QUOTATION_MARK, "\"0123456789abcdef", 17);
+	TEST_SLICE(PARSE_INVALID_STRING_ESCAPE, "\"\\", 2);
+	TEST_SLICE(PARSE_INVALID_UNICODE_HEX, "\"\\u12", 5);
+	TEST_SLICE(PARSE_INVALID_UNICODE_SURROGATE, "\"\\uD834\\u", 9);
+	TEST_SLICE(PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[1,2", 4);
+	TEST_SLICE(PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\":1", 6);
+	TEST_SLICE(PARSE_MISS_COLON, "{\"a\"", 4);
+	TEST_SLICE(PARSE_MISS_KEY, "{\"a\":1,", 7);
+	TEST_SLICE(PARSE_ROOT_NOT_SINGULAR, "1 2", 3);
+}
+
+TEST_CASE("parsePadded", "[parse][length]")
+{
+	/* the padding is garbage that must never be taken for input */
+	std::string json = "[\"a long string value that spans several words\",\"x\"]";
+	std::vector<char> buf(json.begin(), json.end());
+	buf.insert(buf.end(), AJ_PARSE_PADDING, '"');
+	Value v;
+	REQUIRE(PARSE_OK == v.parse(buf.data(), json.size(), PARSE_FLAG_PADDED));
+	REQUIRE(2 == v.getArraySize());
+	REQUIRE(44 == v.getArrayElement(0)->getStringLength());
+	REQUIRE(PARSE_MISS_QUOTATION_MARK == v.parse(buf.data() + 1, 20, PARSE_FLAG_PADDED));
+
+	Document d;
+	Parser p;
+	REQUIRE(PARSE_OK == p.parse(d, buf.data(), json.size(), PARSE_FLAG_PADDED));
+	REQUIRE_STRING("x", d.getArrayElement(1)->getString(), d.getArrayElement(1)->getStringLength());
+	REQUIRE(PARSE_OK == p.parseInsitu(d, buf.data(), json.size(), PARSE_FLAG_PADDED));
+	REQUIRE(d.getArrayElement(1)->getString() == buf.data() + json.size() - 3);
+}
+
+TEST_CASE("simdScanners", "[parse][simd]")
+{
+	/* runs of whitespace and string bytes across every vector boundary */
+	std::string json = "[";
+	for (int i = 0; i < 70; ++i) {
+		json += i ? ",\n" : "\n";
+		json += std::string(i, ' ') + "\t\"" + std::string(i, 'a' + i % 26);
+		if (i % 3 == 0)
+			json += "\\n\\\"\\u00e9";
+		json += "\"\r";
+	}
+	json += "\n]";
+
+	SimdLevel best = simdLevel();
+	for (int level = SIMD_NONE; level <= best; ++level) {
+		REQUIRE(level == setSimdLevel(static_cast<SimdLevel>(level)));
+		for (unsigned flags = PARSE_FLAG_NONE; flags <= PARSE_FLAG_PADDED; ++flags) {
+			std::vector<char> buf(json.begin(), json.end());
+			buf.insert(buf.end(), AJ_PARSE_PADDING, flags ? ' ' : '\0');
+			Value v;
+			REQUIRE(PARSE_OK == v.parse(buf.data(), json.size(), flags));
+			REQUIRE(70 == v.getArraySize());
+			for (int i = 0; i < 70; ++i) {
+				std::string expect(i, 'a' + i % 26);
+				if (i % 3 == 0)
+					expect += "\n\"\xC3\xA9";
+				Value *e = v.getArrayElement(i);
+				REQUIRE(expect == std::string(e->getString(), e->getStringLength()));
+			}
+			std::string plain = "\"" + std::string(70, 'x') + "\"" + std::string(AJ_PARSE_PADDING, '"');
+			for (size_t len = 1; len <= 71; ++len)
+				REQUIRE(PARSE_MISS_QUOTATION_MARK == v.parse(plain.data(), len, flags));
+			std::string ws(50, ' ');
+			REQUIRE(PARSE_EXPECT_VALUE == v.parse(ws.data(), ws.size(), PARSE_FLAG_NONE));
+			REQUIRE(PARSE_INVALID_STRING_CHAR == v.parse(std::string("\"" + std::string(40, 'x') + "\x1f\"")));
+		}
+	}
+	setSimdLevel(best);
+}
+
+/* records every event as text, optionally giving up at the n-th one */
+class TraceHandler : public Handler {
+public:
+	std::string trace;
+	int stopAt = -1;
+
+	bool onNull() override { return add("null"); }
+	bool onBool(bool b) override { return add(b ? "true" : "false"); }
+	bool onNumber(double d) override { return add("d" + std::to_string(static_cast<int>(d))); }
+	bool onInt64(int64_t i) override { return add("i" + std::to_string(i)); }
+	bool onString(const char *s, size_t len) override { return add("s:" + std::string(s, len)); }
+	bool onStartObject() override { return add("{"); }
+	bool onKey(const char *s, size_t len) override { return add("k:" + std::string(s, len)); }
+	bool onEndObject(size_t n) override { return add("}" + std::to_string(n)); }
+	bool onStartArray() override { return add("["); }
+	bool onEndArray(size_t n) override { return add("]" + std::to_string(n)); }
+private:
+	int m_events = 0;
+
+	bool add(const std::string &event)
+	{
+		trace += trace.empty() ? event : " " + event;
+		return m_events++ != stopAt;
+	}
+};
+
+TEST_CASE("parseSax", "[parse][sax]")
+{
+	const char *json = " { \"a\" : [1, -2.5, \"x\\ty\", null], \"b\" : {\"t\":true, \"f\":false}, \"e\":[], \"o\":{} } ";
+	const char *events = "{ k:a [ i1 d-2 s:x\ty null ]4 k:b { k:t true k:f false }2 k:e [ ]0 k:o { }0 }4";
+	TraceHandler h;
+	REQUIRE(PARSE_OK == parse(h, json));
+	REQUIRE(events == h.trace);
+
+	std::vector<char> buf(json, json + strlen(json) + 1);
+	TraceHandler hi;
+	REQUIRE(PARSE_OK == parseInsitu(hi, buf.data()));
+	REQUIRE(events == hi.trace);
+
+	Parser p;
+	for (int i = 0; i < 3; ++i) {
+		TraceHandler hp;
+		REQUIRE(PARSE_OK == p.parse(hp, json));
+		REQUIRE(events == hp.trace);
+	}
+
+	/* integers fall back to onNumber */
+	struct Sum : Handler {
+		double sum = 0;
+		bool onNumber(double d) override { sum += d; return true; }
+	} sum;
+	REQUIRE(PARSE_OK == parse(sum, "[1, 2, {\"x\": 3.5}, 18446744073709551615]"));
+	REQUIRE(6.5 + 18446744073709551615.0 == sum.sum);
+
+	/* errors are the same as for the DOM */
+	Handler none;
+	REQUIRE(PARSE_ROOT_NOT_SINGULAR == parse(none, "[] x"));
+	REQUIRE(PARSE_MISS_KEY == parse(none, "{\"a\":1,}"));
+	REQUIRE(PARSE_MISS_COMMA_OR_SQUARE_BRACKET == parse(none, "[1 2]"));
+	REQUIRE(PARSE_INVALID_STRING_ESCAPE == p.parse(none, "[\"\\v\"]"));
+	REQUIRE(PARSE_OK == p.parse(none, "[\"ok\"]"));
+}
+
+TEST_CASE("parseSaxAbort", "[parse][sax]")
+{
+	const char *json = "{\"a\":[1,\"two\",{\"b\":null}],\"c\":true}";
+	TraceHandler all;
+	REQUIRE(PARSE_OK == parse(all, json));
+	int events = static_cast<int>(std::count(all.trace.begin(), all.trace.end(), ' ')) + 1;
+	for (int n = 0; n < events; ++n) {
+		TraceHandler h;
+		h.stopAt = n;
+		REQUIRE(PARSE_ABORTED == parse(h, json));
+		REQUIRE(h.trace == all.trace.substr(0, h.trace.size()));
+		REQUIRE(static_cast<int>(std::count(h.trace.begin(), h.trace.end(), ' ')) == n);
+	}
+}
+
+/* the same events and result as parse(), whatever the chunking */
+static void testPush(const std::string &json)
+{
+	TraceHandler whole;
+	ParseResult expect = parse(whole, json.data(), json.size());
+	for (size_t chunk = 1; chunk <= json.size() + 1; ++chunk) {
+		TraceHandler h;
+		PushParser p(h);
+		ParseResult res = PARSE_OK;
+		for (size_t i = 0; i < json.size() && res == PARSE_OK; i += chunk)
+			res = p.feed(json.data() + i, std::min(chunk, json.size() - i));
+		ParseResult fin = p.finish();
+		INFO(json << " in chunks of " << chunk);
+		REQUIRE(expect == (res != PARSE_OK ? res : fin));
+		REQUIRE(whole.trace == h.trace);
+		REQUIRE(0 == p.depth());
+	}
+}
+
+TEST_CASE("pushParser", "[parse][push]")
+{
+	testPush(" { \"a\" : [1, -2.5e1, \"x\\ty\\u00e9\\uD834\\uDD1E\", null], \"b\" : {\"t\":true, \"f\":false}, \"e\":[], \"o\":{} } ");
+	testPush("[[[[]]],{\"\":{\"\\\\\":\"\\\"\"}},18446744073709551615,-9223372036854775808,0.1]");
+	testPush("12345678901234567890123");
+	testPush("\"abc\"");
+	testPush("null");
+
+	const char *bad[] = {
+		"", "   ", "nul", "nullx", "-", "1.", "01", "1.2.3", "[1 2]", "[1,", "[", "[}", "{", "{1:2}", "{\"a\"",
+		"{\"a\" 1}", "{\"a\":", "{\"a\":1", "{\"a\":1]", "{\"a\":1,}", "\"abc", "\"a\\", "\"\\v\"", "\"\\u12\"",
+		"\"\\uD800\"", "\"a\x01\"", "[\"a\x01\"]", "{\"a\x01\":1}", "[] []", "[]x", "1e999", "[true,fals]"
+	};
+	for (const char *json : bad)
+		testPush(json);
+
+	/* the parser is reusable after finish(), also after an error */
+	TraceHandler h;
+	PushParser p(h);
+	REQUIRE(PARSE_MISS_COLON == p.feed("{\"a\" 1}", 8));
+	REQUIRE(PARSE_MISS_COLON == p.feed("[]", 2));
+	REQUIRE(PARSE_MISS_COLON == p.finish());
+	h.trace.clear();
+	REQUIRE(PARSE_OK == p.feed("[1,", 3));
+	REQUIRE(1 == p.depth());
+	REQUIRE(PARSE_OK == p.feed(std::string("2]")));
+	REQUIRE(PARSE_OK == p.finish());
+	REQUIRE("[ i1 i2 ]2" == h.trace);
+}
+
+TEST_CASE("pushParserAbort", "[parse][push]")
+{
+	const char *json = "{\"a\":[1,\"two\",{\"b\":null}],\"c\":true}";
+	for (int n = 0; n < 13; ++n) {
+		TraceHandler h;
+		h.stopAt = n;
+		PushParser p(h);
+		ParseResult res = PARSE_OK;
+		for (const char *c = json; *c && res == PARSE_OK; ++c)
+			res = p.feed(c, 1);
+		REQUIRE(PARSE_ABORTED == res);
+		REQUIRE(PARSE_ABORTED == p.finish());
+	}
+}
+
+/* line i holds {"i":i}, except every 7th is blank and every 10th is broken */
+static std::string makeNdjson(size_t lines, size_t longLine = 0)
+{
+	std::string s;
+	for (size_t i = 1; i <= lines; ++i) {
+		if (i % 7 == 0)
+			s += i % 2 ? "" : "  \r";
+		else if (i % 10 == 0)
+			s += "{\"i\":" + std::to_string(i) + ",}";
+		else if (i == longLine)
+			s += "{\"i\":" + std::to_string(i) + ",\"pad\":\"" + std::string(5000, 'x') + "\"}";
+		else
+			s += "{\"i\":" + std::to_string(i) + "}\r";
+		if (i < lines || i % 2)
+			s += "\n";
+	}
+	return s;
+}
+
+/* (line, result, "i" member) per record, in delivery order */
+typedef std::vector<std::tuple<size_t, ParseResult, int64_t>> NdjsonRecords;
+
+static void checkNdjson(const NdjsonRecords &got, const NdjsonStats &stats, size_t lines)
+{
+	size_t records = 0, errors = 0;
+	for (size_t i = 1; i <= lines; ++i) {
+		if (i % 7 == 0)
+			continue;
+		REQUIRE(records < got.size());
+		REQUIRE(i == std::get<0>(got[records]));
+		REQUIRE((i % 10 == 0 ? PARSE_MISS_KEY : PARSE_OK) == std::get<1>(got[records]));
+		REQUIRE((i % 10 == 0 ? 0 : static_cast<int64_t>(i)) == std::get<2>(got[records]));
+		errors += i % 10 == 0;
+		++records;
+	}
+	REQUIRE(records == got.size());
+	REQUIRE(lines == stats.lines);
+	REQUIRE(records == stats.records);
+	REQUIRE(errors == stats.errors);
+}
+
+TEST_CASE("ndjson", "[parse][ndjson][thread]")
+{
+	const size_t lines = 2000;
+	const std::string data = makeNdjson(lines, 1234);
+	for (unsigned threads : { 1u, 4u }) {
+		for (size_t batch : { size_t(1), size_t(100), size_t(AJ_NDJSON_BATCH_SIZE) }) {
+			NdjsonReader r(threads, batch);
+			NdjsonRecords got;
+			std::mutex m;
+			auto collect = [&got, &m](size_t line, ParseResult res, Value &v) {
+				int64_t i = 0;
+				if (res == PARSE_OK && v.type() == VALUE_TYPE_OBJECT)
+					i = v.getObjectValue(0)->getInt64();
+				else if (res == PARSE_OK || v.type() != VALUE_TYPE_NULL)
+					i = -1;
+				std::lock_guard<std::mutex> lock(m);
+				got.emplace_back(line, res, i);
+			};
+			checkNdjson(got, r.read(data.data(), 0, collect), 0);
+			checkNdjson(got, r.read(data.data(), data.size(), collect), lines);
+
+			got.clear();
+			FILE *f = tmpfile();
+			REQUIRE(f != nullptr);
+			fwrite(data.data(), 1, data.size(), f);
+			rewind(f);
+			checkNdjson(got, r.read(f, collect), lines);
+			fclose(f);
+
+			got.clear();
+			r.setOrdered(false);
+			NdjsonStats stats = r.read(data.data(), data.size(), collect);
+			std::sort(got.begin(), got.end());
+			checkNdjson(got, stats, lines);
+		}
+	}
+}
+
+static void writeFile(const char *path, const std::string &data)
+{
+	FILE *f = fopen(path, "wb");
+	REQUIRE(f != nullptr);
+	fwrite(data.data(), 1, data.size(), f);
+	fclose(f);
+}
+
+static std::string readFile(const char *path)
+{
+	std::string data;
+	char buf[4096];
+	FILE *f = fopen(path, "rb");
+	REQUIRE(f != nullptr);
+	for (size_t n; (n = fread(buf, 1, sizeof(buf), f)) > 0;)
+		data.append(buf, n);
+	fclose(f);
+	return data;
+}
+
+TEST_CASE("parseFile", "[parse][file]")
+{
+	const char *path = "ajson_test_file.json";
+	const std::string json = "{\"a\":[1,\"two\",{\"three\":3}],\"s\":\"a\\/b\\u0041\",\"e\":[],\"o\":{}}";
+	const std::string expect = "{\"a\":[1,\"two\",{\"three\":3}],\"s\":\"a/bA\",\"e\":[],\"o\":{}}";
+	writeFile(path, json);
+
+	Value v;
+	REQUIRE(PARSE_OK == v.parseFile(path));
+	REQUIRE(expect == v.stringify());
+	Document d;
+	REQUIRE(PARSE_OK == d.parseFile(path));
+	REQUIRE(expect == d.stringify());
+
+	REQUIRE(PARSE_OK == d.parseFileInsitu(path));
+	REQUIRE(expect == d.stringify());
+	/* the mapping is private: unescaping in place never reaches the file */
+	REQUIRE(json == readFile(path));
+
+	/* sizes around the page boundary, where the zero padding runs out */
+	for (size_t size : { size_t(4096 - AJ_PARSE_PADDING - 1), size_t(4096 - AJ_PARSE_PADDING), size_t(4095), size_t(4096), size_t(4097) }) {
+		std::string big = "[\"" + std::string(size - 4, 'x') + "\"]";
+		REQUIRE(size == big.size());
+		writeFile(path, big);
+		REQUIRE(PARSE_OK == d.parseFileInsitu(path));
+		REQUIRE(size - 4 == d.getArrayElement(0)->getStringLength());
+		REQUIRE(PARSE_OK == v.parseFile(path));
+		REQUIRE(size - 4 == v.getArrayElement(0)->getStringLength());
+		big.back() = ',';
+		writeFile(path, big);
+		REQUIRE(PARSE_EXPECT_VALUE == v.parseFile(path));
+		REQUIRE(PARSE_EXPECT_VALUE == d.parseFileInsitu(path));
+	}
+
+	writeFile(path, "");
+	REQUIRE(PARSE_EXPECT_VALUE == v.parseFile(path));
+	REQUIRE(PARSE_EXPECT_VALUE == d.parseFileInsitu(path));
+	remove(path);
+	REQUIRE(PARSE_FILE_ERROR == v.parseFile(path));
+	REQUIRE(VALUE_TYPE_NULL == v.type());
+	/* a missing file empties the Document without parsing anything */
+	REQUIRE(PARSE_OK == d.parse(json));
+	REQUIRE(PARSE_FILE_ERROR == d.parseFile(path));
+	REQUIRE(VALUE_TYPE_NULL == d.type());
+	REQUIRE(0 == d.arena().used());
+	REQUIRE(PARSE_OK == d.parse(json));
+	REQUIRE(PARSE_FILE_ERROR == d.parseFileInsitu(path));
+	REQUIRE(VALUE_TYPE_NULL == d.type());
+	REQUIRE(0 == d.arena().used());
+	REQUIRE(PARSE_FILE_ERROR == lastParseError().result());
+}
+
+/* every parser reports a failure at the same byte */
+static void requireErrorAt(ParseResult error, const std::string &json, size_t offset)
+{
+	Value v;
+	REQUIRE(error == v.parse(json));
+	REQUIRE(error == lastParseError().result());
+	REQUIRE(offset == lastParseError().offset());
+	std::vector<char> buf(json.begin(), json.end());
+	REQUIRE(error == v.parseInsitu(buf.data(), buf.size()));
+	REQUIRE(offset == lastParseError().offset());
+	Handler h;
+	REQUIRE(error == parse(h, json.data(), json.size()));
+	REQUIRE(offset == lastParseError().offset());
+	Tape t;
+	REQUIRE(error == t.parse(json));
+	REQUIRE(offset == lastParseError().offset());
+	REQUIRE(error == t.parseLazy(json.data(), json.size()));
+	REQUIRE(offset == lastParseError().offset());
+	/* a byte at a time, so every token crosses chunks, and all at once */
+	for (size_t chunk : { size_t(1), json.size() }) {
+		PushParser push(h);
+		ParseResult res = PARSE_OK;
+		for (size_t i = 0; i < json.size() && res == PARSE_OK; i += chunk)
+			res = push.feed(json.data() + i, std::min(chunk, json.size() - i));
+		if (res == PARSE_OK)
+			res = push.finish();
+		REQUIRE(error == res);
+		REQUIRE(offset == lastParseError().offset());
+	}
+}
+
+TEST_CASE("parseErrorPosition", "[parse][error]")
+{
+	requireErrorAt(PARSE_EXPECT_VALUE, "  ", 2);
+	requireErrorAt(PARSE_INVALID_VALUE, "[1,nul]", 3);
+	requireErrorAt(PARSE_INVALID_VALUE, "[1,-x]", 3);
+	requireErrorAt(PARSE_INVALID_VALUE, "[1.]", 1);
+	requireErrorAt(PARSE_INVALID_VALUE, "[1e+]", 1);
+	requireErrorAt(PARSE_ROOT_NOT_SINGULAR, "nullx", 4);
+	requireErrorAt(PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[01]", 2);
+	requireErrorAt(PARSE_ROOT_NOT_SINGULAR, "[] x", 3);
+	requireErrorAt(PARSE_ROOT_NOT_SINGULAR, "0x", 1);
+	requireErrorAt(PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\":1 \"b\"}", 7);
+	requireErrorAt(PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[1 2]", 3);
+	requireErrorAt(PARSE_MISS_KEY, "{\"a\":1,2}", 7);
+	requireErrorAt(PARSE_MISS_COLON, "{\"a\" 1}", 5);
+	requireErrorAt(PARSE_MISS_QUOTATION_MARK, "[\"abc", 5);
+	requireErrorAt(PARSE_INVALID_STRING_ESCAPE, "[\"ab\\x\"]", 4);
+	requireErrorAt(PARSE_INVALID_STRING_ESCAPE, "[1, \"ab\\x\", 3]", 7);
+	requireErrorAt(PARSE_MISS_KEY, "{\"a\x01\":1}", 3);
+	requireErrorAt(PARSE_INVALID_UNICODE_HEX, "[\"ab\\u12\"]", 4);
+	requireErrorAt(PARSE_INVALID_UNICODE_SURROGATE, "[\"\\uD800\\u0041\"]", 2);
+	requireErrorAt(PARSE_INVALID_STRING_CHAR, "[\"a\x01\"]", 3);
+	requireErrorAt(PARSE_DEPTH_EXCEEDED, std::string(2000, '['), AJ_PARSE_MAX_DEPTH);
+
+	/* line, column and snippet are worked out as the parse fails */
+	const std::string json = "{\n\t\"a\": [1, 2],\n\t\"b\": tru\n}";
+	Value v;
+	REQUIRE(PARSE_INVALID_VALUE == v.parse(json));
+	const ParseError &e = lastParseError();
+	REQUIRE(json.find("tru") == e.offset());
+	REQUIRE(3 == e.line());
+	REQUIRE(7 == e.column());
+	REQUIRE(" \"b\": tru\n      ^" == e.snippet());
+	REQUIRE(": tru\n  ^" == e.snippet(2));
+	/* a success leaves the last failure alone */
+	REQUIRE(PARSE_OK == v.parse("[]"));
+	REQUIRE(PARSE_INVALID_VALUE == lastParseError().result());
+	REQUIRE(3 == lastParseError().line());
+
+	/* errors at the end of the input put the caret just past it */
+	REQUIRE(PARSE_MISS_COMMA_OR_SQUARE_BRACKET == v.parse("[1,\n2"));
+	REQUIRE(2 == lastParseError().line());
+	REQUIRE(2 == lastParseError().column());
+	REQUIRE("2\n ^" == lastParseError().snippet());
+
+	/* so the input can go right after, as a temporary does */
+	REQUIRE(PARSE_INVALID_VALUE == v.parse(std::string("[1,\n tru]")));
+	REQUIRE(2 == lastParseError().line());
+	REQUIRE(2 == lastParseError().column());
+	REQUIRE(" tru]\n ^" == lastParseError().snippet());
+
+	/* "\r\n" ends a line once, and a lone '\r' ends one as well */
+	REQUIRE(PARSE_MISS_COMMA_OR_SQUARE_BRACKET == v.parse("[1,\r\n2 3]"));
+	REQUIRE(2 == lastParseError().line());
+	REQUIRE(3 == lastParseError().column());
+	REQUIRE("2 3]\n  ^" == lastParseError().snippet());
+	REQUIRE(PARSE_MISS_COMMA_OR_SQUARE_BRACKET == v.parse("[\r1,\r2 3]"));
+	REQUIRE(3 == lastParseError().line());
+	REQUIRE(3 == lastParseError().column());
+	REQUIRE("2 3]\n  ^" == lastParseError().snippet());
+
+	/* a push parser counts bytes across chunks, but keeps no input */
+	Handler h;
+	PushParser push(h);
+	REQUIRE(PARSE_OK == push.feed("[1,"));
+	REQUIRE(PARSE_MISS_COMMA_OR_SQUARE_BRACKET == push.feed(" 2 3]"));
+	REQUIRE(6 == lastParseError().offset());
+	REQUIRE(0 == lastParseError().line());
+	REQUIRE(lastParseError().snippet().empty());
+	REQUIRE(PARSE_MISS_COMMA_OR_SQUARE_BRACKET == push.finish());
+	REQUIRE(PARSE_OK == push.feed("[1"));
+	REQUIRE(PARSE_MISS_COMMA_OR_SQUARE_BRACKET == push.finish());
+	REQUIRE(2 == lastParseError().offset());
+
+	/* a file is gone after parseFile() returns, so what needs it is worked out before */
+	const char *path = "ajson_test_error.json";
+	writeFile(path, "[\n  1,\n  2 3\n]");
+	REQUIRE(PARSE_MISS_COMMA_OR_SQUARE_BRACKET == v.parseFile(path));
+	REQUIRE(11 == lastParseError().offset());
+	REQUIRE(3 == lastParseError().line());
+	REQUIRE(5 == lastParseError().column());
+	REQUIRE("  2 3\n    ^" == lastParseError().snippet());
+	Document d;
+	REQUIRE(PARSE_MISS_COMMA_OR_SQUARE_BRACKET == d.parseFileInsitu(path));
+	REQUIRE(3 == lastParseError().line());
+	remove(path);
+	REQUIRE(PARSE_FILE_ERROR == d.parseFile(path));
+	REQUIRE(PARSE_FILE_ERROR == lastParseError().result());
+	REQUIRE(0 == lastParseError().line());
+}
+
+static std::string makeObject(size_t members, const char *extra = "")
+{
+	std::string json = "{";
+	for (size_t i = 0; i < members; ++i)
+		json += "\"k" + std::to_string(i) + "\":" + std::to_string(i) + ",";
+	return json + extra + "\"\":-1}";
+}
+
+TEST_CASE("findMember", "[access][object]")
+{
+	for (size_t members : { size_t(0), size_t(3), size_t(AJ_OBJECT_INDEX_MIN - 2), size_t(AJ_OBJECT_INDEX_MIN), size_t(1000) }) {
+		const std::string json = makeObject(members, "\"k1\":\"dup\",\"a\\u0000b\":true,");
+		Value v;
+		REQUIRE(PARSE_OK == v.parse(json));
+		Document d;
+		REQUIRE(PARSE_OK == d.parse(json));
+		std::string insitu = json;
+		Document di;
+		REQUIRE(PARSE_OK == di.parseInsitu(&insitu[0]));
+		for (const Value *o : { static_cast<const Value *>(&v), static_cast<const Value *>(&d), static_cast<const Value *>(&di) }) {
+			for (size_t i = 0; i < members; ++i) {
+				const std::string key = "k" + std::to_string(i);
+				REQUIRE(o->findMember(key) != nullptr);
+				REQUIRE(static_cast<double>(i) == (*o)[key].getNumber());
+			}
+			REQUIRE(-1.0 == (*o)[""].getNumber());
+			REQUIRE(VALUE_TYPE_TRUE == o->findMember("a\0b", 3)->type());
+			REQUIRE(o->findMember("a") == nullptr);
+			REQUIRE(o->findMember("k") == nullptr);
+			REQUIRE(o->findMember("k" + std::to_string(members)) == nullptr);
+			/* a prefix of a stored key, at the stored key's own address */
+			REQUIRE(o->findMember(o->getObjectKey(0), 1) == nullptr);
+			/* duplicate keys: the first one wins, indexed or not */
+			if (members > 1)
+				REQUIRE(1.0 == (*o)["k1"].getNumber());
+			else
+				REQUIRE(std::string("dup") == (*o)["k1"].getString());
+		}
+	}
+
+	/* concurrent first lookups race to build the index */
+	const size_t members = 500;
+	Value v;
+	REQUIRE(PARSE_OK == v.parse(makeObject(members)));
+	std::vector<std::thread> threads;
+	std::atomic<size_t> found(0);
+	for (int t = 0; t < 4; ++t)
+		threads.emplace_back([&v, &found] {
+			for (size_t i = 0; i < members; ++i)
+				if (v.findMember("k" + std::to_string(i)))
+					++found;
+		});
+	for (auto &t : threads)
+		t.join();
+	REQUIRE(4 * members == found);
+}
+
+TEST_CASE("keyTable", "[parse][keys]")
+{
+	const std::string json = "[{\"identifier_key\":1,\"display_name_key\":\"a\",\"tag_collection\":{\"identifier_key\":\"x\"}},{\"display_name_key\":\"b\",\"identifier_key\":2},{\"identifier_\\u006bey\":3,\"extra_field_key\":0}]";
+	/* keys are longer than AJ_COMPACT_VALUE stores inline, so they are interned in either layout */
+	KeyTable keys;
+	Parser p;
+	p.setKeyTable(&keys);
+	Value v;
+	REQUIRE(PARSE_OK == p.parse(v, json.data(), json.size()));
+	REQUIRE("[{\"identifier_key\":1,\"display_name_key\":\"a\",\"tag_collection\":{\"identifier_key\":\"x\"}},{\"display_name_key\":\"b\",\"identifier_key\":2},{\"identifier_key\":3,\"extra_field_key\":0}]" == v.stringify());
+	REQUIRE(4 == keys.size());
+	REQUIRE(8 == keys.stats().lookups);
+	REQUIRE(4 == keys.stats().hits);
+	REQUIRE(3 * 15 + 17 == keys.stats().bytesSaved);
+	const char *id = keys.find("identifier_key");
+	REQUIRE(id != nullptr);
+	REQUIRE(keys.find("nope") == nullptr);
+	/* every "identifier_key" is the one stored copy */
+	REQUIRE(id == v.getArrayElement(0)->getObjectKey(0));
+	REQUIRE(id == (*v.getArrayElement(0))["tag_collection"].getObjectKey(0));
+	REQUIRE(id == v.getArrayElement(1)->getObjectKey(1));
+	REQUIRE(id == v.getArrayElement(2)->getObjectKey(0));
+	REQUIRE(3.0 == (*v.getArrayElement(2))[id].getNumber());
+	REQUIRE(v.getArrayElement(2)->findMember(id, 10) == nullptr);
+	REQUIRE(std::string("b") == (*v.getArrayElement(1))["display_name_key"].getString());
+
+	/* shared across documents, and across Documents and in-situ parses */
+	Value w;
+	REQUIRE(PARSE_OK == p.parse(w, "{\"display_name_key\":null,\"new_field_name_x\":1}"));
+	REQUIRE(v.getArrayElement(0)->getObjectKey(1) == w.getObjectKey(0));
+	REQUIRE(5 == keys.size());
+	Document d;
+	std::string buf = json;
+	REQUIRE(PARSE_OK == p.parseInsitu(d, &buf[0], buf.size()));
+	REQUIRE(id == d.getArrayElement(0)->getObjectKey(0));
+	REQUIRE(v.stringify() == d.stringify());
+
+	/* a failed parse frees nothing it does not own */
+	REQUIRE(PARSE_MISS_COMMA_OR_CURLY_BRACKET == p.parse(w, "[{\"identifier_key\":1,\"display_name_key\":2 \"x\"}]"));
+	p.setKeyTable(nullptr);
+	REQUIRE(PARSE_OK == p.parse(w, "{\"identifier_key\":1}"));
+	REQUIRE(id != w.getObjectKey(0));
+
+	/* a Document's own table */
+	Document own;
+	own.setInternKeys(true);
+	REQUIRE(PARSE_OK == own.parse(json));
+	REQUIRE(4 == own.keys().size());
+	REQUIRE(own.getArrayElement(0)->getObjectKey(0) == own.getArrayElement(1)->getObjectKey(1));
+	REQUIRE(v.stringify() == own.stringify());
+	REQUIRE(PARSE_OK == own.parse("{\"zzzzzzzzzzzzzzzz\":{\"zzzzzzzzzzzzzzzz\":0}}"));
+	REQUIRE(1 == own.keys().size());
+	REQUIRE(std::string("{\"zzzzzzzzzzzzzzzz\":{\"zzzzzzzzzzzzzzzz\":0}}") == own.stringify());
+
+	keys.clear();
+	REQUIRE(0 == keys.size());
+	REQUIRE(keys.find("identifier_key") == nullptr);
+	id = keys.intern("identifier_key", 14);
+	REQUIRE(id == keys.find("identifier_key"));
+	REQUIRE(1 == keys.size());
+}
+
+TEST_CASE("shortStrings", "[parse][layout]")
+{
+#ifdef AJ_COMPACT_VALUE
+	REQUIRE(16 == sizeof(Value));
+	REQUIRE(32 == sizeof(Member));
+#else
+	REQUIRE(24 == sizeof(Value));
+#endif
+	/* lengths around what AJ_COMPACT_VALUE stores inline, as strings and as keys */
+	for (size_t len = 0; len <= 20; ++len) {
+		std::string s;
+		for (size_t i = 0; i < len; ++i)
+			s += static_cast<char>('a' + i);
+		const std::string json = "[\"" + s + "\",{\"" + s + "\":\"" + s + "\"}]";
+		Value v;
+		REQUIRE(PARSE_OK == v.parse(json));
+		REQUIRE(len == v.getArrayElement(0)->getStringLength());
+		REQUIRE(s == v.getArrayElement(0)->getString());
+		Value *o = v.getArrayElement(1);
+		REQUIRE(len == o->getObjectKeyLength(0));
+		REQUIRE(s == o->getObjectKey(0));
+		REQUIRE(s == (*o)[s].getString());
+		Document d;
+		REQUIRE(PARSE_OK == d.parse(json));
+		REQUIRE(s == (*d.getArrayElement(1))[s].getString());
+
+		Value w;
+		w.setString(s.data(), s.size());
+		REQUIRE(len == w.getStringLength());
+		REQUIRE(s == w.getString());
+		/* growing past the inline size and back */
+		w.setString((s + s).data(), 2 * len);
+		REQUIRE(2 * len == w.getStringLength());
+		REQUIRE(s + s == w.getString());
+		w.setString(s.data(), s.size());
+		REQUIRE(s == w.getString());
+		w.setNumber(1.0);
+		REQUIRE(VALUE_TYPE_NUMBER == w.type());
+	}
+}
+
+TEST_CASE("moveCopySwap", "[access][move]")
+{
+	const std::string json = "{\"s\":\"a string too long to be inline\",\"a\":[1,\"x\",{\"k\":null}],\"n\":-2.5}";
+	Value a;
+	REQUIRE(PARSE_OK == a.parse(json));
+
+	Value b(std::move(a));
+	REQUIRE(VALUE_TYPE_NULL == a.type());
+	REQUIRE(json == b.stringify());
+
+	Value c = b.deepCopy();
+	REQUIRE(c["s"].getString() != b["s"].getString());
+	b.setNull();
+	REQUIRE(json == c.stringify());
+
+	/* a part of the value's own tree */
+	c = std::move(c["a"]);
+	REQUIRE("[1,\"x\",{\"k\":null}]" == c.stringify());
+
+	Value d;
+	d.setNumber(1.0);
+	swap(c, d);
+	REQUIRE(1.0 == c.getNumber());
+	REQUIRE(VALUE_TYPE_ARRAY == d.type());
+	d = std::move(c);
+	REQUIRE(VALUE_TYPE_NUMBER == d.type());
+	REQUIRE(VALUE_TYPE_NULL == c.type());
+
+	std::vector<Value> values;
+	for (int i = 0; i < 100; ++i) {
+		values.emplace_back();
+		std::string s = "element " + std::to_string(i) + " of a growing vector";
+		values.back().setString(s.data(), s.size());
+	}
+	values.erase(values.begin());
+	for (int i = 0; i < 99; ++i)
+		REQUIRE("element " + std::to_string(i + 1) + " of a growing vector" == values[i].getString());
+
+	/* strings borrowed from an in-situ buffer are copied */
+	std::string buf = json;
+	a.parseInsitu(&buf[0], buf.size());
+	b = a.deepCopy();
+	buf.assign(buf.size(), ' ');
+	REQUIRE(json == b.stringify());
+
+	/* moving out of a Document copies, so the value outlives it */
+	Value kept;
+	{
+		Document doc;
+		doc.setInternKeys(true);
+		REQUIRE(PARSE_OK == doc.parse(makeObject(100)));
+		kept = std::move(doc);
+		REQUIRE(101 == doc.getObjectSize());
+	}
+	REQUIRE(101 == kept.getObjectSize());
+	REQUIRE(42 == kept["k42"].getInt64());
+	REQUIRE(-1 == kept[""].getInt64());
+}
+
+static Value number(double d)
+{
+	Value v;
+	v.setNumber(d);
+	return v;
+}
+
+TEST_CASE("buildArray", "[access][build]")
+{
+	Value a;
+	a.setArray();
+	REQUIRE(0 == a.getArraySize());
+	REQUIRE(0 == a.getArrayCapacity());
+	for (int i = 0; i < 1000; ++i) {
+		Value &e = a.pushBack(number(i));
+		REQUIRE(i == e.getNumber());
+		REQUIRE(a.getArrayCapacity() >= a.getArraySize());
+	}
+	REQUIRE(1000 == a.getArraySize());
+	REQUIRE(a.getArrayCapacity() < 2000);
+	a.erase(10, 980);
+	REQUIRE(20 == a.getArraySize());
+	REQUIRE(995 == a.getArrayElement(15)->getNumber());
+	a.popBack();
+	a.insert(0, number(-1)).setString("first", 5);
+	a.insert(a.getArraySize(), number(1e3));
+	REQUIRE(21 == a.getArraySize());
+	REQUIRE(std::string("first") == a.getArrayElement(0)->getString());
+	REQUIRE(0 == a.getArrayElement(1)->getNumber());
+	REQUIRE(1e3 == a.getArrayElement(20)->getNumber());
+
+	/* an element of the array itself, and growing a parsed array */
+	Value p;
+	REQUIRE(PARSE_OK == p.parse("[[1,2],\"a string too long to be inline\"]"));
+	REQUIRE(2 == p.getArrayCapacity());
+	p.pushBack(std::move(*p.getArrayElement(1)));
+	p.getArrayElement(0)->pushBack(Value()).setBool(true);
+	REQUIRE("[[1,2,true],null,\"a string too long to be inline\"]" == p.stringify());
+	p.reserve(100);
+	REQUIRE(100 == p.getArrayCapacity());
+	p.erase(0, 3);
+	REQUIRE("[]" == p.stringify());
+
+	Value r;
+	r.setArray(8);
+	REQUIRE(8 == r.getArrayCapacity());
+	r.pushBack(std::move(a));
+	REQUIRE(VALUE_TYPE_NULL == a.type());
+	REQUIRE(21 == r.getArrayElement(0)->getArraySize());
+}
+
+TEST_CASE("buildObject", "[access][build]")
+{
+	const size_t n = AJ_OBJECT_INDEX_MIN * 4;
+	Value o;
+	o.setObject();
+	for (size_t i = 0; i < n; ++i) {
+		std::string k = "k" + std::to_string(i);
+		o.addMember(k, number(static_cast<double>(i)));
+		/* lookups between appends keep using and extending the index */
+		REQUIRE(i == o[k].getNumber());
+		REQUIRE(0 == o["k0"].getNumber());
+	}
+	REQUIRE(n == o.getObjectSize());
+	REQUIRE(o.getObjectCapacity() >= n);
+	o.addMember("k1", number(-1));
+	REQUIRE(1 == o["k1"].getNumber());
+	REQUIRE(o.removeMember("k1"));
+	REQUIRE(-1 == o["k1"].getNumber());
+	REQUIRE(o.removeMember("k1"));
+	REQUIRE(!o.findMember("k1"));
+	REQUIRE(!o.removeMember("k1"));
+	REQUIRE(n - 1 == o.getObjectSize());
+	REQUIRE(std::string("k2") == o.getObjectKey(1));
+	for (size_t i = 2; i < n; ++i)
+		REQUIRE(i == o["k" + std::to_string(i)].getNumber());
+	o.addMember("", 0, Value()).setObject(2);
+	o[""].addMember("x", number(1));
+	REQUIRE(std::string("{\"x\":1.0}") == o[""].stringify());
+
+	/* parsed objects, with keys owned, borrowed from a buffer or interned */
+	const std::string json = makeObject(AJ_OBJECT_INDEX_MIN + 1);
+	for (int mode = 0; mode < 3; ++mode) {
+		std::string buf = json;
+		KeyTable keys;
+		Parser parser;
+		parser.setKeyTable(&keys);
+		Value p;
+		if (mode == 0)
+			REQUIRE(PARSE_OK == p.parse(json));
+		else if (mode == 1)
+			REQUIRE(PARSE_OK == p.parseInsitu(&buf[0], buf.size()));
+		else
+			REQUIRE(PARSE_OK == parser.parse(p, json.data(), json.size()));
+		REQUIRE(3 == p["k3"].getNumber());
+		REQUIRE(p.removeMember("k3"));
+		REQUIRE(!p.findMember("k3"));
+		REQUIRE(4 == p["k4"].getNumber());
+		p.addMember("added", number(1));
+		p.addMember(p.getObjectKey(0), number(2));
+		REQUIRE(p.removeMember("k0"));
+		REQUIRE(2 == p["k0"].getNumber());
+		REQUIRE(-1 == p[""].getNumber());
+		Value copy = p.deepCopy();
+		REQUIRE(copy.stringify() == p.stringify());
+	}
+}
+
+TEST_CASE("writer", "[stringify][writer]")
+{
+	StringSink out;
+	{
+		Writer w(out, 16);
+		REQUIRE(w.startObject());
+		REQUIRE(w.key("n"));
+		REQUIRE(w.null());
+		REQUIRE(w.key("b"));
+		REQUIRE(w.boolean(false));
+		REQUIRE(w.key("a"));
+		REQUIRE(w.startArray());
+		REQUIRE(w.number(1.5));
+		REQUIRE(w.int64(-7));
+		REQUIRE(w.uint64(18446744073709551615ULL));
+		REQUIRE(w.string(""));
+		REQUIRE(w.string(std::string("back\\slash quote\"")));
+		REQUIRE(w.startArray());
+		REQUIRE(w.endArray());
+		REQUIRE(w.startObject());
+		REQUIRE(w.endObject());
+		REQUIRE(w.endArray());
+		REQUIRE(w.key(""));
+		Value v;
+		REQUIRE(PARSE_OK == v.parse("{\"x\":[true,{}]}"));
+		REQUIRE(w.value(v));
+		REQUIRE(!w.complete());
+		REQUIRE(w.endObject());
+		REQUIRE(w.complete());
+		/* the 16-byte buffer has been handed over in chunks as it filled */
+		REQUIRE(out.str().size() > 16);
+	}
+	const std::string expect = "{\"n\":null,\"b\":false,\"a\":[1.5,-7,18446744073709551615,\"\",\"back\\\\slash quote\\\"\",[],{}],"
+		"\"\":{\"x\":[true,{}]}}";
+	REQUIRE(expect == out.str());
+	Value check;
+	REQUIRE(PARSE_OK == check.parse(out.str()));
+	REQUIRE(expect == check.stringify());
+
+	char buf[32];
+	FixedSink fixed(buf, sizeof(buf));
+	{
+		Writer w(fixed, 8);
+		w.startArray();
+		REQUIRE(w.string("0123456789"));
+		REQUIRE(w.string("0123456789"));
+		/* the third string is cut at the first piece that does not fit, and everything after it is dropped */
+		REQUIRE(!w.string("0123456789"));
+		REQUIRE(!w.endArray());
+	}
+	REQUIRE(std::string("[\"0123456789\",\"0123456789\",\"") == std::string(buf, fixed.size()));
+
+	for (int fd = 0; fd < 2; ++fd) {
+		FILE *f = tmpfile();
+		REQUIRE(f != nullptr);
+		{
+			FileSink file(f);
+			FdSink desc(fileno(f));
+			Writer w(fd ? static_cast<OutputSink &>(desc) : file);
+			w.startArray();
+			for (int i = 0; i < 10000; ++i)
+				w.int64(i);
+			REQUIRE(w.endArray());
+		}
+		fflush(f);
+		rewind(f);
+		std::string text;
+		char chunk[4096];
+		for (size_t n; (n = fread(chunk, 1, sizeof(chunk), f)) > 0;)
+			text.append(chunk, n);
+		fclose(f);
+		Value v;
+		REQUIRE(PARSE_OK == v.parse(text));
+		REQUIRE(10000 == v.getArraySize());
+		REQUIRE(9999 == v.getArrayElement(9999)->getInt64());
+	}
+}
+
+static void requireSame(const Value &v, Tape::Cursor c)
+{
+	REQUIRE(c);
+	REQUIRE(v.type() == c.type());
+	switch (v.type()) {
+	case VALUE_TYPE_NUMBER: REQUIRE(v.getNumber() == c.getNumber()); break;
+	case VALUE_TYPE_INT64: REQUIRE(v.getInt64() == c.getInt64()); break;
+	case VALUE_TYPE_UINT64: REQUIRE(v.getUint64() == c.getUint64()); break;
+	case VALUE_TYPE_STRING:
+		REQUIRE(std::string(v.getString(), v.getStringLength()) == std::string(c.getString(), c.getStringLength()));
+		REQUIRE('\0' == c.getString()[c.getStringLength()]);
+		break;
+	case VALUE_TYPE_ARRAY: {
+		REQUIRE(v.getArraySize() == c.getArraySize());
+		Tape::Cursor e = c.first();
+		for (size_t i = 0; i < v.getArraySize(); ++i, e = e.next())
+			requireSame(*v.getArrayElement(i), e);
+		REQUIRE(!e);
+		break;
+	}
+	case VALUE_TYPE_OBJECT: {
+		REQUIRE(v.getObjectSize() == c.getObjectSize());
+		Tape::Cursor k = c.first();
+		for (size_t i = 0; i < v.getObjectSize(); ++i, k = k.next().next()) {
+			REQUIRE(std::string(v.getObjectKey(i), v.getObjectKeyLength(i)) == std::string(k.getString(), k.getStringLength()));
+			requireSame(*v.getObjectValue(i), k.next());
+		}
+		REQUIRE(!k);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+TEST_CASE("tape", "[parse][tape]")
+{
+	const char *docs[] = {
+		"null", " true ", "false", "0", "-1.5e3", "123456789012", "-9223372036854775808", "18446744073709551615", "\"\"",
+		"[]", "{}", "[[],{},[[]]]", "{\"a\":{\"b\":{\"c\":[]}}}",
+		"[null , false , true , 123 , \"abc\"]",
+		" { \"n\" : null , \"f\" : false , \"t\" : true , \"i\" : 123 , \"s\" : \"abc\", \"a\" : [ 1, 2, 3 ],"
+		" \"o\" : { \"1\" : 1, \"2\" : 2, \"3\" : 3 } } ",
+		"[\"\\\"\\\\\\/\\b\\f\\n\\r\\t\", \"\\u20AC\\uD834\\uDD1E\", \"{[:,]}\"]",
+	};
+	std::vector<std::string> inputs(docs, docs + sizeof(docs) / sizeof(docs[0]));
+	/* backslash runs, escaped quotes and structural characters in strings around 64-byte block edges */
+	for (size_t offset = 50; offset < 140; ++offset)
+		for (size_t run = 1; run <= 4; ++run)
+			inputs.push_back("[\"" + std::string(offset, 'a') + std::string(run, '\\') + (run % 2 ? "\"" : "") + "],{\",\"}\",{\"k\":[1,true,null,-2.5]},12]");
+	for (size_t len = 60; len < 70; ++len)
+		inputs.push_back(std::string(len, ' ') + "[1234567890," + std::string(len, '1') + "e-3,\"x\"]");
+
+	SimdLevel best = simdLevel();
+	for (int level = SIMD_NONE; level <= best; ++level) {
+		REQUIRE(level == setSimdLevel(static_cast<SimdLevel>(level)));
+		Tape t;
+		for (const std::string &json : inputs) {
+			Value v;
+			REQUIRE(PARSE_OK == v.parse(json));
+			REQUIRE(PARSE_OK == t.parse(json));
+			requireSame(v, t.root());
+			REQUIRE(!t.root().next());
+			REQUIRE(PARSE_OK == t.parseLazy(json.data(), json.size()));
+			requireSame(v, t.root());
+			/* a second walk reads what the first decoded */
+			requireSame(v, t.root());
+		}
+	}
+	setSimdLevel(best);
+
+	Tape t;
+	REQUIRE(PARSE_OK == t.parse(makeObject(100)));
+	Tape::Cursor o = t.root();
+	REQUIRE(101 == o.getObjectSize());
+	REQUIRE(std::string("k42") == o.getObjectKey(42));
+	REQUIRE(3 == o.getObjectKeyLength(42));
+	REQUIRE(42 == o.getObjectValue(42).getInt64());
+	REQUIRE(99 == o.findMember("k99").getNumber());
+	REQUIRE(-1 == o.findMember("").getNumber());
+	REQUIRE(!o.findMember("k100"));
+	REQUIRE(PARSE_OK == t.parse("[[1,[2,[3]]],{\"a\":[4]},5]"));
+	/* next() skips whole subtrees */
+	REQUIRE(5 == t.root().getArrayElement(2).getNumber());
+	REQUIRE(4 == t.root().getArrayElement(1).findMember("a").getArrayElement(0).getNumber());
+	REQUIRE(3 == t.root().getArraySize());
+	REQUIRE(2 == t.root().first().getArraySize());
+
+	/* errors past the first block, and beyond what Value::parse gets to see in one call */
+	std::string big = "[" + std::string(100, ' ') + "1x]";
+	REQUIRE(PARSE_MISS_COMMA_OR_SQUARE_BRACKET == t.parse(big));
+	REQUIRE(!t.root());
+	REQUIRE(PARSE_MISS_COMMA_OR_CURLY_BRACKET == t.parse("{\"a\":truex}"));
+	REQUIRE(PARSE_MISS_QUOTATION_MARK == t.parse("[\"" + std::string(200, 'a') + "\\\"]"));
+	/* refused before the input is read, so the length alone is enough */
+	REQUIRE(PARSE_INPUT_TOO_LARGE == t.parse("[]", size_t(UINT32_MAX)));
+	REQUIRE(!t.root());
+	REQUIRE(PARSE_INPUT_TOO_LARGE == lastParseError().result());
+	REQUIRE(PARSE_INPUT_TOO_LARGE == t.parseLazy("[]", size_t(UINT32_MAX)));
+	REQUIRE(PARSE_OK == t.parse("[]", 2));
+}
+
+TEST_CASE("tapeLazy", "[parse][tape]")
+{
+	Tape t;
+	std::string json = "{\"id\":17,\"name\":\"a\\u00e9\",\"big\":18446744073709551615,\"x\\\"y\":-0.25,"
+		"\"skip\":[[\"\\n\",{\"deep\":[1e2,\"z\"]}],-3],\"\\u0061b\":true,\"ab\":false}";
+	REQUIRE(PARSE_OK == t.parseLazy(json.data(), json.size()));
+	Tape::Cursor o = t.root();
+	REQUIRE(7 == o.getObjectSize());
+	/* nothing is decoded up front */
+	REQUIRE(0 == t.stringBytes());
+	REQUIRE(VALUE_TYPE_INT64 == o.findMember("id").type());
+	REQUIRE(17 == o.findMember("id").getInt64());
+	REQUIRE(0 == t.stringBytes());
+	REQUIRE(std::string("a\xC3\xA9") == o.findMember("name").getString());
+	size_t decoded = t.stringBytes();
+	REQUIRE(decoded > 0);
+	REQUIRE(std::string("a\xC3\xA9") == o.findMember("name").getString());
+	REQUIRE(decoded == t.stringBytes());
+	REQUIRE(18446744073709551615ULL == o.findMember("big").getUint64());
+	REQUIRE(-0.25 == o.findMember("x\"y").getNumber());
+	/* an escaped key still matches what it decodes to, and is found before a later plain one */
+	REQUIRE(o.findMember("ab").getBool());
+	REQUIRE(!o.findMember("a\\b"));
+	REQUIRE(!o.findMember("nam"));
+	REQUIRE(-3 == o.findMember("skip").getArrayElement(1).getInt64());
+	REQUIRE(100 == o.findMember("skip").first().getArrayElement(1).findMember("deep").first().getNumber());
+
+	/* errors a lazy parse defers nothing of */
+	REQUIRE(PARSE_INVALID_STRING_ESCAPE == t.parseLazy("[1,\"\\x\"]"));
+	REQUIRE(PARSE_INVALID_UNICODE_SURROGATE == t.parseLazy("[1,\"\\uD800\"]"));
+	REQUIRE(PARSE_NUMBER_TOO_BIG == t.parseLazy("[1,1e309]"));
+	REQUIRE(PARSE_INVALID_VALUE == t.parseLazy("[1.]"));
+	REQUIRE(PARSE_ROOT_NOT_SINGULAR == t.parseLazy("0123"));
+	REQUIRE(!t.root());
+}
+
 void aaa(const Value &a)
 {
 	a.stringify();
@@ -405,4 +2055,4 @@ int main()
 	printf("%s\n", a.stringify().c_str());
 	aaa(a);
 	return result;
-}
\ No newline at end of file
+}